@@ -3,6 +3,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "array.h"
 #include "regex.h"
 
@@ -13,13 +16,24 @@
    caters for this.
    2. grep allows null expressions, hence REG_NULL.
    3. it may be possible to combine the multiple 
-   patterns of grep into single patterns.  important
-   special cases are handled by regcomb().
+   patterns of grep into single patterns.  literal
+   strings are gathered into one by regcomb(); the rest
+   are matched together, in one pass over a line, by
+   a regset.
    4. anchoring by -x has to be done separately from
    compilation (remember that fgrep has no ^ or $ operator),
    hence REG_ANCH.  (An honest, but slow
    alternative: run regexec with REG_NOSUB off and nmatch=1
    and check whether the match is full length)
+   5. compiling many patterns takes a while, so -k keeps
+   them compiled in a file, which regmap() uses in place
+   the next time the same patterns come with the same
+   options.
+   6. a pattern that backtracks can take very long on a
+   line.  -t and -T bound the milliseconds and the steps
+   for a line by regctxbudget().  a line that takes more
+   is reported and taken not to match, and the search goes
+   on; grep then exits with status 2.
 */
 
 int Eflag;	// like egrep
@@ -31,6 +45,10 @@ int nflag;	// line numbers
 int sflag;	// no messages for unopenable files
 int vflag;	// reverse sense; seek nonmatches
 int hflag;	// do not print file-name headers
+char *kfile;	// cache of compiled patterns
+int optgiven;	// some option that shapes the patterns was given
+unsigned long tflag;	// most milliseconds to match a line
+unsigned long Tflag;	// most backtracking steps to match a line
 
 /* the Array<> definitions allow for a quantity of patterns,
    or a length of input line that is unbounded except by
@@ -40,20 +58,33 @@ Array<char*> argpat;
 int nargpat;
 Array<char*> filepat;
 int nfilepat;
+Array<char> pats;	// every pattern line, each ending in 0
+int npats;		// bytes in pats
 Array<regex_t> re;
+Array<int> source;	// where in pats re[i] begins
 int nre;
+int comb = -1;		// re[comb] may take more strings,
+int combined;		// and has taken some
+regset_t reset;		// re[] together, if nre > 1
 Array<char> line;
+regctx_t *ctx;	// matcher's scratch space, kept from line to line
 
 int hits, anyhits;
+int spent;	// some line ran out of time or steps
 int retval = 1;	// what to return for no hits
 int options = REG_NOSUB | REG_NULL;
 int nfiles;
 
 void grepcomp();
-void docomp(char *s);
+void addpat(char *s);
+void docomp(int at);
+int loadcache();
+void savecache();
 int getline(FILE *input, const char *name);
+size_t mapfile(FILE *input, char **map);
 void execute(FILE *input, const char *name);
 void doregerror(int result, const char *name, int lineno);
+void regwarn(int result, const char *name, int lineno);
 void warn(const char *s, const char *t);
 void error(const char *s, const char *t);
 
@@ -61,22 +92,26 @@ int
 main(int argc, char **argv)
 {
 	for(;;) {
-		switch(getopt(argc, argv, "AEFclqinsvxe:f:h")) {
+		switch(getopt(argc, argv, "AEFclqinsvxe:f:hk:t:T:")) {
 		case 'A':
+			optgiven = 1;
 			options |= REG_AUGMENTED;
 			if(REG_AUGMENTED)
 				continue;
 			
 		case '?':
 			fprintf(stderr,
-			  "usage: grep -EFclqinsvxh pattern [file] ...\n"
-			  "       grep -EFclqinsvxh -ef pattern-or-file ... [file] ...\n");
+			  "usage: grep -EFclqinsvxh [-k cache] [-t ms] [-T steps] pattern [file] ...\n"
+			  "       grep -EFclqinsvxh [-k cache] [-t ms] [-T steps] -ef pattern-or-file ... [file] ...\n"
+			  "       grep -clqnsvh -k cache [-t ms] [-T steps] [file] ...\n");
 			exit(2);
 		case 'E':
+			optgiven = 1;
 			Eflag = 1;
 			options |= REG_EXTENDED;
 			continue;
 		case 'F':
+			optgiven = 1;
 			Fflag = 1;
 			options |= REG_LITERAL;
 			continue;
@@ -90,6 +125,7 @@ main(int argc, char **argv)
 			qflag = 1;
 			continue;
 		case 'i':
+			optgiven = 1;
 			options |= REG_ICASE;
 			continue;
 		case 'n':
@@ -102,6 +138,7 @@ main(int argc, char **argv)
 			vflag = 1;
 			continue;
 		case 'x':
+			optgiven = 1;
 			options |= REG_ANCH;
 			continue;
 		case 'h':
@@ -115,12 +152,21 @@ main(int argc, char **argv)
 			filepat.assure(nfilepat);
 			filepat[nfilepat++] = optarg;
 			continue;
+		case 'k':
+			kfile = optarg;
+			continue;
+		case 't':
+			tflag = strtoul(optarg, 0, 10);
+			continue;
+		case 'T':
+			Tflag = strtoul(optarg, 0, 10);
+			continue;
 		case -1:
 			break;
 		}
 		break;
 	}
-	if(nargpat + nfilepat == 0) {
+	if(nargpat + nfilepat == 0 && kfile == 0) {
 		if(optind >= argc)
 			error("no pattern", "");
 		else
@@ -144,7 +190,9 @@ main(int argc, char **argv)
 		if(qflag && anyhits)
 			break;
 	}
-	return anyhits? 0: retval;
+	if(qflag && anyhits)
+		return 0;
+	return spent? 2: anyhits? 0: retval;
 }
 
 /* the update s = t+1 flagged below is formally illegal when
@@ -160,7 +208,7 @@ grepcomp()
 			t = strchr(s, '\n');
 			if(t)
 				*t = 0;
-			docomp(s);
+			addpat(s);
 		}	
 	}
 
@@ -168,27 +216,195 @@ grepcomp()
 		FILE *patfile = fopen(filepat[i], "r");
 		if(patfile)
 			while(getline(patfile, filepat[i]) >= 0)
-				docomp(&line[0]);
+				addpat(&line[0]);
 		else if(!sflag)
 			error("cannot open", filepat[i]);
 		else
 			retval = 2;
 		fclose(patfile);
 	}
-	if(nre == 0)
-		error("no pattern", "");
+	if(kfile==0 || !loadcache()) {
+		if(npats==0 && kfile)
+			error("no patterns in", kfile);
+		for(i=0; i<npats; i+=strlen(&pats[i])+1)
+			docomp(i);
+		if(nre == 0)
+			error("no pattern", "");
+		if(kfile)
+			savecache();
+	}
+	if(nre > 1 && (i = regsetmake(&reset, &re[0], nre, options)))
+		doregerror(i, "", 0);
 }
 
 void
-docomp(char *s)
+addpat(char *s)
 {
-	if(re.assure(nre))
+	int n = strlen(s) + 1;
+	if(pats.assure(npats+n))
+		error("out of space at--", s);
+	memmove(&pats[npats], s, n);
+	npats += n;
+}
+
+/* strings are gathered by regcomb into the first pattern
+   that takes them, past patterns of other kinds */
+
+void
+docomp(int at)
+{
+	char *s = &pats[at];
+	if(re.assure(nre) || source.assure(nre))
 		error("out of space at--", s);
 	int result = regcomp(&re[nre], s, options);
 	if(result)
 		doregerror(result, s, 0);
-	if(!nre || !regcomb(&re[nre-1], &re[nre]))
-		nre++;
+	if(comb>=0 && regcomb(&re[comb], &re[nre])) {
+		combined = 1;
+		return;
+	}
+	if(!combined)		// keep strings already gathered
+		comb = nre;
+	source[nre++] = at;
+}
+
+/* the cache file is a Khead, then for each regex_t the
+   bytes from regsave, or the pattern if it can't be saved,
+   each after a Krec and padded to 8 bytes for regmap */
+
+const char KMAGIC[8] = "grepk1\n";
+
+struct Khead {
+	char magic[8];
+	unsigned long hash;	// of options and patterns
+	int options;
+	int nre;
+};
+
+struct Krec {
+	int kind;		// 'R' from regsave, 'S' a pattern
+	int len;
+};
+
+unsigned long
+hash()
+{
+	unsigned long h = 14695981039346656037UL;	// FNV-1a
+	unsigned char *o = (unsigned char*)&options;
+	int i;
+	for(i=-(int)sizeof(options); i<npats; i++) {
+		h ^= i<0? o[i+sizeof(options)]: (unsigned char)pats[i];
+		h *= 1099511628211UL;
+	}
+	return h;
+}
+
+/* take re[] from kfile, if it was made from the patterns
+   given, or from any if none are.  with none, the options
+   are those the file was made with, and any given must
+   agree.  returns 0 if not */
+
+int
+loadcache()
+{
+	struct stat st;
+	int i, fd = open(kfile, O_RDONLY);
+	if(fd < 0)
+		return 0;
+	if(fstat(fd, &st)<0 || (size_t)st.st_size<sizeof(Khead)) {
+		close(fd);
+		return 0;
+	}
+	char *p = (char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE,
+			fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return 0;
+	Khead *h = (Khead*)p;
+	char *q = p + sizeof(Khead), *e = p + st.st_size;
+	if(memcmp(h->magic, KMAGIC, sizeof(KMAGIC)) != 0 ||
+	   (npats && (h->hash!=hash() || h->options!=options)) ||
+	   h->nre<=0 || re.assure(h->nre)) {
+		munmap(p, st.st_size);
+		return 0;
+	}
+	if(npats==0 && optgiven && h->options!=options)
+		error("options differ from those of the patterns in", kfile);
+	for(i=0; i<h->nre; i++) {
+		Krec *r = (Krec*)q;
+		int result = REG_BADPAT;
+		if((size_t)(e-q) < sizeof(Krec))
+			break;
+		q += sizeof(Krec);
+		if(r->len<0 || ((r->len + 7L) & ~7L) > e-q)
+			break;
+		if(r->kind == 'R')
+			result = regmap(&re[i], q, r->len);
+		else if(r->kind=='S' && r->len>0 && q[r->len-1]==0)
+			result = regcomp(&re[i], q, h->options);
+		if(result)
+			break;
+		q += (r->len + 7) & ~7;
+	}
+	if(i < h->nre) {		// the file is damaged
+		while(--i >= 0)
+			regfree(&re[i]);
+		munmap(p, st.st_size);
+		return 0;
+	}
+	nre = h->nre;
+	options = h->options;
+	return 1;			// p stays mapped for re[]
+}
+
+/* write re[] into kfile, by way of a temporary file so
+   that no other grep sees it half written */
+
+void
+savecache()
+{
+	Array<char> temp, buf;
+	Khead h;
+	Krec r;
+	int i;
+	static const char pad[8] = { 0 };
+	if(temp.assure(strlen(kfile)+5))
+		error("out of space at--", kfile);
+	sprintf(&temp[0], "%s.tmp", kfile);
+	FILE *f = fopen(&temp[0], "w");
+	if(f == 0) {
+		warn("cannot write", &temp[0]);
+		return;
+	}
+	memset(&h, 0, sizeof(h));
+	memmove(h.magic, KMAGIC, sizeof(KMAGIC));
+	h.hash = hash();
+	h.options = options;
+	h.nre = nre;
+	fwrite(&h, sizeof(h), 1, f);
+	for(i=0; i<nre; i++) {
+		size_t len = regsave(&re[i], 0, 0);
+		char *p = &pats[source[i]];
+		if(len) {
+			if(buf.assure(len))
+				error("out of space at--", kfile);
+			regsave(&re[i], &buf[0], len);
+			p = &buf[0];
+			r.kind = 'R';
+		} else {
+			len = strlen(p) + 1;
+			r.kind = 'S';
+		}
+		r.len = len;
+		fwrite(&r, sizeof(r), 1, f);
+		fwrite(p, 1, len, f);
+		fwrite(pad, 1, -len & 7, f);
+	}
+	if(ferror(f) | fclose(f)) {
+		warn("cannot write", &temp[0]);
+		remove(&temp[0]);
+	} else if(rename(&temp[0], kfile) != 0)
+		warn("cannot write", kfile);
 }
 
 int
@@ -213,23 +429,67 @@ getline(FILE *input, const char *name)
 	}
 }
 
+/* map an input that is a file, unread, so lines can be
+   matched in place.  returns its size, with *map 0 if it
+   must be read */
+
+size_t
+mapfile(FILE *input, char **map)
+{
+	struct stat st;
+	int fd = fileno(input);
+	*map = 0;
+	if(fstat(fd, &st)<0 || !S_ISREG(st.st_mode) || st.st_size==0 ||
+	   lseek(fd, 0, SEEK_CUR)!=0 || ftell(input)!=0)
+		return 0;
+	void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p == MAP_FAILED)
+		return 0;
+	*map = (char*)p;
+	return st.st_size;
+}
+
 void
 execute(FILE *input, const char *name)
 {
-	int i, lineno;
+	int lineno;
 	int hits = 0;
-	for(lineno=1; ; lineno++) {
-		int n = getline(input, name);
-		if(n < 0)
-			break;
-		for(i=0; i<nre; i++) {
-			int result = regnexec(&re[i], &line[0], n, 0, 0, 0);
-			if(result == 0) 
+	char *map, *p, *e;
+	size_t size = mapfile(input, &map);
+	if(ctx == 0) {
+		ctx = regctxalloc();	// 0 will do, but slower
+		regctxbudget(ctx, Tflag, tflag);
+	}
+	for(p=map, e=map+size, lineno=1; ; lineno++) {
+		char *s;
+		int n;
+		if(map) {		// match the line where it lies
+			if(p >= e)
+				break;
+			char *q = (char*)memchr(p, '\n', e-p);
+			if(q == 0) {
+				warn("newline appended to ", name);
+				q = e;
+			}
+			s = p;
+			n = q - p;
+			p = q + 1;
+		} else {
+			n = getline(input, name);
+			if(n < 0)
 				break;
-			if(result != REG_NOMATCH)
-				doregerror(result, name, lineno);
+			s = &line[0];
 		}
-		if((i<nre) ^ vflag) {
+		int result = nre>1?
+			regsetexec(&reset, ctx, s, n, 0, 0, 0):
+			regctxexec(&re[0], ctx, s, n, 0, 0, 0);
+		if(result == REG_EBUDGET) {	// give up on the line only
+			regwarn(result, name, lineno);
+			spent = 1;
+			result = REG_NOMATCH;
+		} else if(result != REG_NOMATCH)
+			doregerror(result, name, lineno);
+		if((result == 0) ^ vflag) {
 			hits++;
 			if(qflag | lflag)
 				break;
@@ -239,9 +499,12 @@ execute(FILE *input, const char *name)
 				printf("%s:", name);
 			if(nflag)
 				printf("%d:", lineno);
-			printf("%s\n", line.bytes());
+			fwrite(s, 1, n, stdout);
+			putchar('\n');
 		}
 	}
+	if(map)
+		munmap(map, size);
 	if(hits)
 		anyhits = 1;
 	if(qflag)
@@ -258,16 +521,22 @@ execute(FILE *input, const char *name)
 void
 doregerror(int result, const char *name, int lineno)
 {
-	char errbuf[100];
 	if(result==0 || result==REG_NOMATCH)
 		return;
+	regwarn(result, name, lineno);
+	exit(2);
+}
+
+void
+regwarn(int result, const char *name, int lineno)
+{
+	char errbuf[100];
 	regerror(result, 0, errbuf, sizeof(errbuf));
 	fprintf(stderr, "grep: %s: %s", errbuf, name);
 	if(lineno)
 		fprintf(stderr, ":%d\n", lineno);
 	else
 		fprintf(stderr, "\n");
-	exit(2);
 }
 
 void
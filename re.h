@@ -25,17 +25,23 @@ enum {	RE_DUP_MAX  = -(INT_MIN/2)-1,	// 2*RE_DUP_MAX won't overflow
 #ifndef REG_AUGMENTED
 #define REG_AUGMENTED 0
 #endif
+#ifndef REG_JIT
+#define REG_JIT 0
+#endif
 
 /* it is believed that the codes defined in regex.h are
    contiguous, but their order is not recalled */
 
 enum {	CFLAGS = REG_EXTENDED | REG_ICASE | REG_NOSUB | REG_NEWLINE,
 	EFLAGS = REG_NOTBOL | REG_NOTEOL,
-	GFLAGS = REG_NULL | REG_ANCH | REG_LITERAL | REG_AUGMENTED,
+	GFLAGS = REG_NULL | REG_ANCH | REG_LITERAL | REG_AUGMENTED |
+		REG_JIT,
 	ALLBIT0 = CFLAGS | EFLAGS | GFLAGS,
 	NEWBIT1 = (ALLBIT0<<1) & ~ALLBIT0,
 	NEWBIT2 = NEWBIT1 << 1,
-	NEWBIT3 = NEWBIT2 << 1
+	NEWBIT3 = NEWBIT2 << 1,
+	NEWBIT4 = NEWBIT3 << 1,
+	NEWBIT5 = NEWBIT4 << 1
 };
 
 typedef unsigned char uchar;
@@ -71,7 +77,7 @@ enum Type {
 	CONJ,			// a&b
 	REP,			// Kleene closure
 	NEG,			// negation
-	KMP,			// Knuth-Morris-Pratt
+	FIND,			// leading string, searched for
 	KR,			// modified Karp-Rabin
 	DONE,			// completed match, used internally
 	TEMP			// node kept on stack
@@ -81,16 +87,38 @@ enum {			// local environment flags
 	SPACE = NEWBIT1,	// out of space
 	EASY = 0,		// greedy match known to work
 	HARD = NEWBIT2,		// otherwise
-	ONCE = NEWBIT3		// if 1st parse fails, quit
+	ONCE = NEWBIT3,		// if 1st parse fails, quit
+	STALE = NEWBIT4,	// ready() is yet to be called
+	SPENT = NEWBIT5		// budget of steps or time spent
 };
 
 struct Eenv;	// environment during regexec()
 struct Cenv;	// environment during regcomp()
 struct Stat;	// used during regcomp()
 
+/* An Arena holds the Rex nodes of one regex_t, and their
+   strings, in a few big blocks.  Nodes are never freed one
+   by one; regfree() runs the destructors of all the nodes
+   in the list own, then frees the blocks.
+*/
+struct Arena {
+	enum { BLOCK = 1024 };
+	struct Block { Block *next; };
+	Block *block;		// blocks in use, newest first
+	uchar *p;		// free space in the newest
+	size_t left;
+	Array<Rex*> own;	// every node made here
+	int nown;
+	Arena() : block(0), p(0), left(0), nown(0) { }
+	~Arena();
+	void *alloc(size_t);
+	Seg copy(Seg);
+};
+
 /* Rex is a node in a regular expression; TEMP nodes live
-   temporarily on the stack during recognition by regexec;
-   their next pointer should not be followed by ~Rex()
+   temporarily on the stack during recognition by regexec.
+   Others are made in an Arena, and destroying a node does
+   not destroy the nodes it points to
 */
 struct Rex {
 	uchar type;	// what flavor of Rex
@@ -98,6 +126,9 @@ struct Rex {
 	Rex *next;	// following part of reg exp
 	Rex(int type=TEMP) : type(type), next(0) { }
 	virtual ~Rex();
+	void *operator new(size_t n, Arena *a) noexcept {
+		return a->alloc(n); }
+	void operator delete(void*, Arena*) { }
 	virtual Stat stat(Cenv*);
 	virtual int serialize(int n);
 	virtual int parse(uchar*, Rex*, Eenv*);
@@ -105,6 +136,7 @@ struct Rex {
 	int follow(uchar *s, Rex *cont, Eenv *env);
 protected:
 	void dprint(const char *, const uchar *);
+	void operator delete(void*) { }	// see Arena
 };
 
 struct Dup : Rex {	// for all duplicated expressions
@@ -174,19 +206,22 @@ struct Dot : Dup {
 
 struct Class : Dup {
 	Set cl;
+	uchar nib[2][16];	// cl by low nibble, for SIMD runs
 	Class() : Dup(1,1,CLASS), cl() { }
 	int parse(uchar *, Rex*,Eenv*);
 	int in(int c) { return cl.in(c); }
 	void orset(Set*);
 	void icase(uchar *map);
 	void neg(int cflags);
+	void nibbles();		// make nib, once cl is done
 	void print();
 };
 
 struct Onechar : Dup {
 	uchar c;
-	Onechar(int c, int lo=1, int hi=1) :
-		Dup(lo,hi,ONECHAR), c(c) { }
+	int nb;			// how many bytes map to c, 0 if >2
+	uchar b[2];		// the bytes
+	Onechar(int c, uchar *map, int lo=1, int hi=1);
 	int parse(uchar*, Rex*, Eenv*);
 	void print();
 };
@@ -194,20 +229,52 @@ struct Onechar : Dup {
 struct String : Rex {
 	Seg seg;	
 	String(Seg seg, uchar *map = 0);
-	~String() { delete [] seg.p; }
 	Stat stat(Cenv*);
 	int parse(uchar *, Rex*, Eenv*);
 	void print();
 protected:
-	String() { };		// for Kmp and Kr only
+	String() { };		// for Find and Kr only
 };
 
-struct Kmp : String {		// for string first in pattern
-	Array<int> fail;
-	Kmp(Seg seg, int*);		// ICASE-mapped already
+struct Find : String {		// for string first in pattern
+	Array<int> fail;	// for Knuth-Morris-Pratt
+	int at;			// which byte to look for
+	int nb;			// how many bytes map to it, 0 if >2
+	uchar b[2];		// the bytes
+	Find(Seg seg, uchar*, int*);	// ICASE-mapped already
 	int parse(uchar*, Rex*, Eenv*);
+private:
+	uchar *next(uchar*, uchar*, uchar*, uchar**);
+	int kmp(uchar*, uchar*, Rex*, Eenv*);
 };
 
+/* Teddy, after the matcher of that name in Hyperscan,
+   screens for the first m bytes of the words of a small
+   Trie, 16 places at a time where there are SIMD shuffles.
+   The distinct prefixes are dealt into 8 buckets.  mask[j][c]
+   has the bit of each bucket with a prefix whose byte j
+   is c after mapping; lo and hi split it by nibble for the
+   shuffles.  A candidate is a place where some bucket
+   survives every byte; the Trie confirms it.
+*/
+struct Teddy {
+	enum { NPREFIX = 64, NBYTE = 3 };
+	int m;			// bytes in a prefix
+	uchar simd;		// shuffles are available
+	uchar mask[NBYTE][UCHAR_MAX+1];
+	uchar lo[NBYTE][16];
+	uchar hi[NBYTE][16];
+	Teddy(uchar*, int, int, uchar*);
+	uchar *find(uchar*, uchar*);
+};
+
+/* regsave() lays its parts out on 8-byte boundaries */
+
+inline size_t align8(size_t n)
+{
+	return (n + 7) & ~(size_t)7;
+}
+
 /* data structure for an alternation of pure strings
    son points to a subtree of all strings with a common
    prefix ending in character c.  sib links alternate
@@ -215,30 +282,66 @@ struct Kmp : String {		// for string first in pattern
    some word ends with c.  the order of strings is
    irrelevant, except long words must be investigated
    before short ones.  The first level of trie is indexed
-   into buckets.
+   into buckets.  Nodes live in one array and are linked
+   by index; 0 means none.  Before first use, ready() lays
+   them out breadth first, with sibs adjacent, and builds
+   the Aho-Corasick links fail and out, so that find() can
+   locate the leftmost word in a single pass.  A trie too
+   big for a Prog that is only tried at one place instead
+   has its common suffixes merged, as in a DAWG.  A Trie
+   made by regmap() uses the nodes and tables in place, in
+   the buffer that regsave() filled.
 */
 struct Trie : Rex {
-	enum { MASK = UCHAR_MAX, NROOT = MASK+1 };
+	enum { MASK = UCHAR_MAX, NROOT = MASK+1,
+		DENSE = 8	// sons enough to merit a table
+	};
 	struct Tnode {
 		uchar c;
 		uchar end;
-		Tnode *son;
-		Tnode *sib;
-		Tnode(uchar c) : c(c), end(0), son(0), sib(0) { }
-		~Tnode() { delete son; delete sib; }
+		int son;
+		int sib;
+		int fail;	// longest proper suffix in trie
+		int out;	// longest word that is a suffix
+		int dense;	// which table holds the sons, or -1
 	};
 	int min, max;		// length of entry
-	Tnode *root[NROOT];	// index of trie roots
+	int nnode;		// number of Tnodes
+	Array<Tnode> node;	// the Tnodes, from node[1]
+	int root[NROOT];	// index of trie roots
+	Array<int> table;	// sons of bushy nodes, NROOT apiece
+	uchar ac;		// 1 if links are built, 2 if can't be
+	uchar merged;		// suffixes are shared
+	uchar mapped;		// node and table aren't ours
+	Teddy *teddy;		// screens for the words, if few
 	int insert(uchar*);
-	Trie() : Rex(TRIE), min(INT_MAX), max(0) { 
+	void ready(int, uchar*);
+	uchar *find(uchar*, uchar*, uchar*);
+	size_t save(uchar*, size_t);
+	int map(uchar*, size_t);
+	Trie() : Rex(TRIE), min(INT_MAX), max(0), nnode(0),
+		ac(0), merged(0), mapped(0), teddy(0) {
 		memset(root, 0, sizeof(root)); }
-	~Trie() { for(int i=0; i<NROOT; i++) delete root[i]; }
+	~Trie() {
+		delete teddy;
+		if(mapped) {		// keep Array from freeing them
+			node.p = node.space;
+			table.p = table.space;
+		}
+	}
 	Stat stat(Cenv*);
 	int parse(uchar *s, Rex *contin, Eenv *env);
 	void print();
 private:
-	int parse(Tnode*, uchar*, Rex*, Eenv*);
-	void print(Tnode*, int, Array<uchar>&);
+	int parse(int, uchar*, Rex*, Eenv*);
+	void print(int, int, Array<uchar>&);
+	int newnode(int);
+	int child(int, int);
+	int pack();
+	int link();
+	int merge();
+	int prefixes(int, uchar*, int, int, Array<uchar>&, int&);
+	int begins(uchar*, uchar*, uchar*);
 };
 
 struct Back : Rex {
@@ -255,7 +358,6 @@ struct Subexp : Rex {
 	Rex *rex;		// contents
 	Subexp(int n, Rex *rex)
 		: Rex(SUBEXP), n(n), rex(rex), used(0) { }
-	~Subexp() { delete(rex); }
 	int serialize(int);
 	Stat stat(Cenv*);
 	int parse(uchar *, Rex*,Eenv*);
@@ -269,7 +371,6 @@ struct Alt: Rex {
 	int rserial;
 	Alt(int n1, int n2, Rex* left, Rex *right) :
 	  Rex(ALT), n1(n1), n2(n2), left(left), right(right) { }
-	~Alt() { delete(left); delete(right); }
 	int serialize(int);
 	Stat stat(Cenv*);
 	int parse(uchar *, Rex*,Eenv*);
@@ -281,7 +382,6 @@ struct Conj: Rex {
 	Rex *right;
 	Conj(Rex *left, Rex *right) :
 	   Rex(CONJ), left(left), right(right) { }
-	~Conj() { delete left; delete right; }
 	int serialize(int);
 	Stat stat(Cenv*);
 	int parse(uchar*, Rex*, Eenv*);
@@ -292,10 +392,10 @@ struct Rep : Dup {
 	int n1;		// subexpression number, or 0
 	int n2;		// last contained subexpression number
 	Rex *rex;
+	int memo;	// number of memo point, or -1
 	Rep(int lo, int hi, int n1, int n2, Rex *rex) :
 		Dup(lo,hi,REP), n1(n1), n2(n2),
-		rex(rex) { }
-	~Rep() { delete rex; };
+		rex(rex), memo(-1) { }
 	int serialize(int);
 	Stat stat(Cenv*);
 	int parse(uchar *, Rex*, Eenv*);
@@ -306,7 +406,6 @@ struct Rep : Dup {
 struct Neg : Rex {
 	Rex *rex;
 	Neg(Rex *rex) : Rex(NEG), rex(rex) { }
-	~Neg() { delete rex; }
 	int serialize(int);
 	Stat stat(Cenv*);
 	int parse(uchar*, Rex*, Eenv*);
@@ -320,6 +419,231 @@ struct Neg : Rex {
 
 struct Done : Rex {
 	static Rex *done;	// pointer to the one copy
+	void *operator new(size_t n) { return ::operator new(n); }
+	void operator delete(void *p) { ::operator delete(p); }
 	int parse(uchar *, Rex*, Eenv*);
 	void print() { }
 };
+
+/* Pos is for comparing parses. An entry is made in the
+   array at the beginning and at the end of each Rep,
+   each iteration in a Rep, and each Alt
+*/
+
+struct Pos {
+	uchar *p;	// where in string
+	short serial;	// subpattern number in preorder
+	uchar be;	// which end of pair
+};
+/* Ctx holds the arrays that regnexec needs, so that they
+   can be kept from call to call: those of Eenv, threads
+   for Tdfa::exec, the stack and registers of backexec(),
+   and the Pike machine of re4.cpp, made when first needed
+*/
+struct Pike;
+
+struct Bframe {		// on the stack of backexec() in re5.cpp
+	int pc;		// where to resume, or -1-i to restore reg[i]
+	int p;		// where in the string, or the old value
+};
+
+struct Ctx {
+	Array<Pos> pos;
+	Array<Pos> bestpos;
+	Array<regmatch_t> match;
+	Array<regmatch_t> best;
+	Array<char> memo;
+	Array<int> tdfa;
+	Array<Bframe> stack;
+	Array<int> reg;
+	Pike *pike;
+	size_t limit;		// see regctxlimit()
+	unsigned long steps;	// see regctxbudget()
+	unsigned long msec;
+	Ctx() : pike(0), limit(0), steps(0), msec(0) { }
+	~Ctx();
+};
+
+/* what a backtracking match may spend, in steps and in
+   time, counted down by spent() at every step.  the clock
+   is read only every TICK steps, when left runs out */
+
+struct Budget {
+	unsigned long left;	// steps before over() is called
+	unsigned long steps;	// steps allowed after those
+	int counted;		// steps are limited
+	int timed;		// there is a deadline
+	long sec, nsec;		// the deadline, on CLOCK_MONOTONIC
+	Budget(Ctx*);
+	void arm();
+	int over();
+	int spent() { return --left == 0 && over(); }
+};
+
+/* memo bits lie place by place, those of a place together,
+   and are cleared as far as the places come into use, a
+   stretch at a time, not all before a match.  so a match
+   near the start of a long subject costs little, as it
+   must for regiterexec.  clear is the first byte not yet
+   cleared */
+
+inline char *memobyte(Array<char> &memo, int size, int &clear, int bit)
+{
+	enum { STRETCH = 64 };
+	int i = bit / CHAR_BIT;
+	if(i >= clear) {
+		int e = i+STRETCH<size? i+STRETCH: size;
+		memset(&memo[clear], 0, e-clear);
+		clear = e;
+	}
+	return &memo[i];
+}
+
+enum {
+	BEGR,		// beginning of a repetition
+	BEGI,		// beginning of one iteration of a rep
+	BEGA,		// beginning of an alt
+	BEGS,		// beginning of a subexpression
+	ENDP		// end of any of above
+};
+
+/* Prog is a flat nondeterministic automaton made from a
+   Rex tree, for the matchers in re3.cpp and re4.cpp that
+   do not backtrack.  Instructions are numbered from 0.
+   x is the successor; y is the alternate of a SPLIT or
+   the byte set of a CHR.  MARK instructions stand where the
+   recursive matcher would call Eenv::pushpos.  Patterns
+   with Back, Neg or Conj have no Prog.
+*/
+
+enum Op {
+	CHR,		// one byte from set[y]
+	SPLIT,		// x, or else y
+	BOL,		// ^
+	EOL,		// $
+	MARK,		// either end of a subpattern
+	MATCH		// completed match
+};
+
+enum {			// Inst::empty, at end of an iteration
+	NOCHECK,	// a null iteration is fine
+	KILL,		// a null iteration is unwanted
+	EXIT		// after a null iteration, leave via y
+};
+
+struct Inst {
+	uchar op;	// Op
+	uchar be;	// MARK: which end, as in Pos
+	uchar empty;	// MARK ending an iteration
+	short serial;	// MARK: subpattern number
+	short n1, n2;	// MARK: subexpressions cleared, or delimited
+	int x;		// successor
+	int y;		// alternate, byte set, or exit
+	void setmatch(int p, size_t nmatch, regmatch_t *match);
+};
+
+struct Dfa;
+struct Tdfa;
+struct Jit;
+
+struct Prog {
+	enum { MAXINST = 1<<15 };
+	Array<Inst> inst;	// the program
+	int ninst;
+	Array<Set> set;		// byte sets for CHR
+	int nset;
+	int start;		// first instruction
+	int flags;		// regcomp flags
+	uchar anchored;		// try only at the beginning
+	uchar null;		// can match the empty string
+	Set first;		// bytes that can begin a match
+	volatile int busy;	// dfa is in use
+	Dfa *dfa;		// built lazily by dfaexec
+	Jit *jit[2];		// dfa as code, by REG_NOTEOL
+	uchar nojit[2];		// jit was tried and failed
+	volatile int tbusy;	// tdfa is being made
+	Tdfa *tdfa;		// built lazily by tagexec
+	Array<int> memo;	// memo point of a CHR, or -1
+	int nmemo;
+	int nserial;		// subpattern serials are less
+	int nid;		// patterns of a regset, told apart by
+				// the y of their MATCHes; else 0
+	Prog(int flags) : ninst(0), nset(0), start(-1),
+		flags(flags), anchored(0), null(0), busy(0), dfa(0),
+		tbusy(0), tdfa(0), nmemo(0), nserial(0), nid(0) {
+		jit[0] = jit[1] = 0;
+		nojit[0] = nojit[1] = 0;
+	}
+	~Prog();
+	int classes(uchar*);
+	int dfaexec(uchar*, uchar*, int);
+	int setexec(uchar*, uchar*, int, uchar*);
+	int tagexec(uchar*, size_t, size_t, regmatch_t*, int, Ctx*);
+	int pikeexec(uchar*, size_t, size_t, regmatch_t*, int, Ctx*);
+};
+
+/* a DFA made whole, for jit() in re6.cpp to compile.
+   state i goes to next[i*nclass + cls[c]] on byte c; stop
+   and acc are as in the Dstates of re3.cpp */
+
+enum {				// stop and acc bits
+	ACC0 = 1,		// match at this point
+	ACC1 = 2,		// match at this point if $ matches
+	DEAD = 4		// no match is possible
+};
+
+struct Dtab {
+	int nstate;
+	int nclass;
+	uchar cls[UCHAR_MAX+1];
+	int start[2];		// start states, by bol
+	Array<int> next;
+	Array<uchar> stop;	// tested before each char
+	Array<uchar> acc;	// tested at the end
+	int flags;		// REG_NEWLINE and REG_NOTEOL, for $
+};
+
+extern Jit *jit(Dtab*);
+extern int jitexec(Jit*, uchar*, uchar*, int);
+extern void jitfree(Jit*);
+
+extern Prog *mkProg(regex_t*);
+extern int setadd(Prog*, regex_t*, int);
+extern Prog *ready(regex_t*);
+extern int backexec(const regex_t*, Ctx*, uchar*, size_t, uchar*,
+	size_t, regmatch_t*, int);
+
+/* Start tells where a match can begin, so that regnexec
+   need not try every position: only at a byte in first,
+   unless any is set; only at the beginning of a line, if
+   nl; and only where min bytes remain.
+*/
+
+struct Start {
+	Set first;	// bytes that can begin a match
+	uchar any;	// first is no help
+	uchar nl;	// under REG_NEWLINE, a match begins a line
+	int one;	// the only byte in first, or -1
+	int min;	// minimum length of a match
+	uchar *find(uchar*, uchar*, uchar*);
+};
+
+/* Must is a literal that every match contains, found by
+   regcomp so that regnexec can reject a string, or skip
+   to the places where a match might begin, before parsing.
+   off is the distance of the literal from the start of
+   every match, or -1 if that varies.
+*/
+
+struct Must {
+	Seg seg;	// the literal
+	int off;	// where it stands in a match, or -1
+	Must(Seg seg, int off) : seg(seg), off(off) { }
+	~Must() { delete [] seg.p; }
+	uchar *find(uchar*, uchar*);
+};
+
+/* where a parse need next be tried; see re1.cpp */
+
+extern uchar *candidate(Trie*, Must*, Start*, uchar*, uchar*, uchar*,
+	uchar*);
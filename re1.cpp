@@ -2,7 +2,14 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
 #include "re.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SHUFFLE		// SSSE3, if the cpu has it
+#endif
 
 /* regular expression recognizer. parse() is coded in
    continuation-passing style.
@@ -17,24 +24,6 @@ int edebug = 0;	// OR of types to be traced in parsing
 #define debug(type, msg, s)
 #endif
 
-/* Pos is for comparing parses. An entry is made in the
-   array at the beginning and at the end of each Rep,
-   each iteration in a Rep, and each Alt
-*/
-
-struct Pos {
-	uchar *p;	// where in string
-	short serial;	// subpattern number in preorder
-	uchar be;	// which end of pair
-};
-enum {
-	BEGR,		// beginning of a repetition
-	BEGI,		// beginning of one iteration of a rep
-	BEGA,		// beginning of an alt
-	BEGS,		// beginning of a subexpression
-	ENDP		// end of any of above
-};
-
 /* returns from parse(). seemingly one might better handle
    BAD by longjmp, but that would not work with threads
    and it would skip the ~Save destructor.  as for
@@ -48,7 +37,54 @@ enum {	NONE,		// no parse found
 
 /* execution environment.  would be more efficient if it
    were in static store.  kept on stack so it will run
-   under multiple threads */
+   under multiple threads.  the arrays are in a Ctx, which
+   may outlive it */
+
+enum { MEMOBITS = 1<<20 };	// most memo bits to use
+
+/* a parse goes deeper on the C stack with every step, and
+   stops MARGIN short of the end of the stack of the thread
+   it runs on.  the end is found once per thread, from the
+   thread's attributes, which for the main thread follow
+   RLIMIT_STACK; failing that, from RLIMIT_STACK, half of it
+   below where the first match began; failing that,
+   FALLBACK below there.  stacks are taken to grow down.
+   regctxlimit() may set a nearer bound */
+
+enum { MARGIN = 128<<10, FALLBACK = 1<<20 };
+
+static uchar *
+stackfloor(uchar *here)
+{
+	static __thread uchar *floor;
+	size_t size = 0;
+	if(floor)
+		return floor;
+#ifdef __GLIBC__
+	pthread_attr_t attr;
+	void *addr;
+	if(pthread_getattr_np(pthread_self(), &attr) == 0) {
+		if(pthread_attr_getstack(&attr, &addr, &size) == 0 &&
+		   here > (uchar*)addr && here-(uchar*)addr <= (long)size)
+			floor = (uchar*)addr;
+		else
+			size = 0;
+		pthread_attr_destroy(&attr);
+	}
+#endif
+	struct rlimit rl;
+	if(floor == 0 && getrlimit(RLIMIT_STACK, &rl) == 0 &&
+	   rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur/2 < (size_t)here) {
+		size = rl.rlim_cur/2;
+		floor = here - size;
+	}
+	if(floor == 0) {
+		size = FALLBACK;
+		floor = here - size;
+	}
+	floor += size/4 < MARGIN? size/4: MARGIN;
+	return floor;
+}
 
 struct Eenv {
 	int flags;		// compile and exec flags
@@ -56,12 +92,18 @@ struct Eenv {
 	uchar *p;		// beginning of string
 	uchar *last;		// end of string
 	int npos;		// how much of pos is used
+	uchar *floor;		// the C stack may go down to here
 	int nbestpos;		// ditto for bestpos
-	Array<Pos> pos;		// posns of certain subpatterns
-	Array<Pos> bestpos;	// ditto for best match
-	Array<regmatch_t> match;// subexrs in current match 
-	Array<regmatch_t> best;	// ditto in best match yet
-	Eenv(const regex_t *preg, int eflags, uchar *string, size_t len);
+	Array<Pos> &pos;	// posns of certain subpatterns
+	Array<Pos> &bestpos;	// ditto for best match
+	Array<regmatch_t> &match;// subexrs in current match 
+	Array<regmatch_t> &best;// ditto in best match yet
+	Array<char> &memo;	// bits for memo points that failed
+	int memosize;		// bytes of them, or 0 if none
+	int memoclear;		// see memobyte()
+	Budget budget;		// steps and time left
+	Eenv(const regex_t *preg, int eflags, uchar *string, size_t len,
+		Ctx *ctx);
 	int pushpos(Rex*, uchar*, int);
 	void poppos() { npos--; }
 };
@@ -102,9 +144,11 @@ static void printpos(Pos *pos, int n, Eenv *env)	/* for debugging */
 static regmatch_t NOMATCH = { -1, -1 };
 
 inline
-Eenv::Eenv(const regex_t *preg, int eflags, uchar *string, size_t len) :
-	preg(preg), p(string), last(string+len),
-	flags((eflags&EFLAGS) | preg->flags)
+Eenv::Eenv(const regex_t *preg, int eflags, uchar *string, size_t len,
+	Ctx *ctx) : flags((eflags&EFLAGS) | preg->flags), preg(preg),
+	p(string), last(string+len), pos(ctx->pos),
+	bestpos(ctx->bestpos), match(ctx->match), best(ctx->best),
+	memo(ctx->memo), budget(ctx)
 {
 	int n = preg->re_nsub;
 	if(match.assure(n) || best.assure(n)) {
@@ -112,8 +156,19 @@ Eenv::Eenv(const regex_t *preg, int eflags, uchar *string, size_t len) :
 		return;
 	}
 	npos = nbestpos = 0;
+	uchar *base = (uchar*)this;	// Eenv is on the stack
+	floor = stackfloor(base);
+	if(ctx->limit && base > floor && (size_t)(base-floor) > ctx->limit)
+		floor = base - ctx->limit;
 	best[0].rm_so = 0;
 	best[0].rm_eo = -1;
+	memosize = 0;
+	memoclear = 0;
+	if(preg->nmemo && len < (size_t)(MEMOBITS/preg->nmemo)) {
+		n = (preg->nmemo*(len+1) + CHAR_BIT-1)/CHAR_BIT;
+		if(memo.assure(n) == 0)
+			memosize = n;
+	}
 }
 
 Seg Seg::copy()
@@ -149,8 +204,6 @@ void Set::clear()
 
 Rex::~Rex()
 {
-	if(type!=TEMP)
-		delete next;
 }
 
 void Rex::dprint(const char *msg, const uchar *s)
@@ -252,20 +305,21 @@ void Trie::print()
 			print(root[i], 0, s);
 		}
 }
-void Trie::print(Tnode *node, int n, Array<uchar> &s)
+void Trie::print(int i, int n, Array<uchar> &s)
 {
 	for(;;) {
+		Tnode *t = &node[i];
 		s.assure(n);
-		s[n] = node->c;
-		if(node->son) {
-			print(node->son, n+1, s);
-			if(node->end)
+		s[n] = t->c;
+		if(t->son) {
+			print(t->son, n+1, s);
+			if(t->end)
 				printf("|");
 		}
-		if(node->end)
+		if(t->end)
 			printf("%.*s", n+1, &s[0]);
-		node = node->sib;
-		if(node == 0)
+		i = t->sib;
+		if(i == 0)
 			return;
 		printf("|");
 	}
@@ -318,6 +372,15 @@ int Rex::parse(uchar*, Rex*, Eenv*)	// pure virtual, avoid libC++
 
 inline int Rex::follow(uchar *s, Rex *cont, Eenv *env)
 {
+	uchar here;		// top of the C stack, about
+	if(&here < env->floor) {
+		env->flags |= SPACE;
+		return BAD;
+	}
+	if(env->budget.spent()) {
+		env->flags |= SPENT;
+		return BAD;
+	}
 	return next? next->parse(s, cont, env):
 		     cont->parse(s, 0, env);
 }
@@ -340,12 +403,82 @@ int Anchor::parse(uchar *s, Rex *cont, Eenv *env)
 int End::parse(uchar *s, Rex *cont, Eenv *env)
 {
 	debug(END, "End", s);
-	if((*s==0 && !(env->flags&REG_NOTEOL)) ||
-	    ((env->flags&REG_NEWLINE) && *s=='\n'))
+	if(s<env->last? env->flags&REG_NEWLINE && *s=='\n':
+	   !(env->flags&REG_NOTEOL))
 		return follow(s, cont, env);
 	return NONE;
 }
 
+/* run kernels, for repetitions of a single byte or class:
+   how many of the n bytes from s are b0 or b1, or are in the
+   class whose nibble tables are nib, before one is not.
+   SSE2 is always there on x86-64; SSSE3 is asked about.
+   the first few bytes are tried one by one, since most
+   runs are short */
+
+enum { SHORT = 8 };
+
+static int
+span2(uchar *s, int n, uchar b0, uchar b1)
+{
+	int i = 0;
+	while(i<n && i<SHORT && (s[i]==b0 || s[i]==b1))
+		i++;
+#ifdef SHUFFLE
+	if(i < SHORT)
+		return i;
+	__m128i x = _mm_set1_epi8(b0);
+	__m128i y = _mm_set1_epi8(b1);
+	for( ; n-i >= 16; i+=16) {
+		__m128i c = _mm_loadu_si128((__m128i*)(s+i));
+		int bits = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(c, x), _mm_cmpeq_epi8(c, y)));
+		if(bits != 0xffff)
+			return i + __builtin_ctz(~bits);
+	}
+#endif
+	for( ; i<n; i++)
+		if(s[i]!=b0 && s[i]!=b1)
+			break;
+	return i;
+}
+
+#ifdef SHUFFLE
+
+/* the low nibble picks a byte of nib[0] or nib[1], by the
+   high bit of the high nibble, and the rest of the high
+   nibble picks a bit of that byte */
+
+__attribute__((target("ssse3")))
+static int
+spanset(uchar nib[2][16], uchar *s, int n)
+{
+	__m128i t0 = _mm_loadu_si128((__m128i*)nib[0]);
+	__m128i t1 = _mm_loadu_si128((__m128i*)nib[1]);
+	__m128i bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+				1, 2, 4, 8, 16, 32, 64, -128);
+	__m128i nibble = _mm_set1_epi8(0xf);
+	__m128i seven = _mm_set1_epi8(7);
+	__m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for( ; n-i >= 16; i+=16) {
+		__m128i c = _mm_loadu_si128((__m128i*)(s+i));
+		__m128i l = _mm_and_si128(c, nibble);
+		__m128i h = _mm_and_si128(_mm_srli_epi16(c, 4), nibble);
+		__m128i high = _mm_cmpgt_epi8(h, seven);
+		__m128i row = _mm_or_si128(
+			_mm_andnot_si128(high, _mm_shuffle_epi8(t0, l)),
+			_mm_and_si128(high, _mm_shuffle_epi8(t1, l)));
+		row = _mm_and_si128(row, _mm_shuffle_epi8(bit, h));
+		int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(row, zero));
+		if(bits)
+			return i + __builtin_ctz(bits);
+	}
+	return i;
+}
+
+#endif
+
 int Dot::parse(uchar *s, Rex *cont, Eenv *env)
 {
 	debug(DOT, "Dot", s);
@@ -353,9 +486,9 @@ int Dot::parse(uchar *s, Rex *cont, Eenv *env)
 	if(n > env->last-s)
 		n = env->last-s;
 	if(env->flags&REG_NEWLINE) {
-		for(int i=0 ; i<n; i++)
-			if(s[i] == '\n')
-				n = i;
+		uchar *nl = (uchar*)memchr(s, '\n', n);
+		if(nl)
+			n = nl - s;
 	}
 	int result = NONE;
 	for(s+=n; n-->=lo; s--)
@@ -378,9 +511,12 @@ int Onechar::parse(uchar *s, Rex *cont, Eenv *env)
 	if(n > env->last-s)
 		n = env->last-s;
 	int i = 0;
-	for( ; i<n; i++,s++)
-		if(map[*s] != c)
-			break;
+	if(nb)
+		i = span2(s, n, b[0], b[nb-1]);
+	else
+		while(i<n && map[s[i]]==c)
+			i++;
+	s += i;
 	int result = NONE;
 	for( ; i-->=lo; s--)
 		switch(follow(s, cont, env)) {
@@ -400,9 +536,17 @@ int Class::parse(uchar *s, Rex *cont, Eenv *env)
 	int n = hi;
 	if(n > env->last-s)
 		n = env->last-s;
-	for(int i=0; i<n; i++)
+	int i = 0;
+	while(i<n && i<SHORT && cl.in(s[i]))
+		i++;
+#ifdef SHUFFLE
+	if(i==SHORT && __builtin_cpu_supports("ssse3"))
+		i += spanset(nib, s+i, n-i);
+#endif
+	for( ; i<n; i++)
 		if(!cl.in(s[i]))
-			n = i;
+			break;
+	n = i;
 	int result = NONE;
 	for(s+=n; n-->=lo; s--)
 		switch(follow(s, cont, env)) {
@@ -435,6 +579,25 @@ void Class::icase(uchar *map)
 			cl.insert(tolower(i));
 		}
 }
+void Class::nibbles()
+{
+	memset(nib, 0, sizeof(nib));
+	for(int i=0; i<256; i+=CHAR_BIT)
+		if(cl.cl[i/CHAR_BIT])
+			for(int j=i; j<i+CHAR_BIT; j++)
+				if(cl.in(j))
+					nib[j>>7][j&0xf] |= 1 << (j>>4&7);
+}
+
+Onechar::Onechar(int c, uchar *map, int lo, int hi) :
+	Dup(lo, hi, ONECHAR), c(c)
+{
+	for(int i=nb=0; i<=UCHAR_MAX; i++)
+		if(map[i] == c && nb++ < 2)
+			b[nb-1] = i;
+	if(nb > 2)
+		nb = 0;
+}
 
 String::String(Seg s, uchar *map) : Rex(STRING), seg(s)
 {
@@ -450,21 +613,63 @@ int String::parse(uchar *s, Rex *cont, Eenv *env)
 		return NONE;
 	uchar *map = env->preg->map;
 	uchar *p = seg.p;
-	while(*p)
+	if(map['A'] != map['a']) {		// no REG_ICASE
+		if(memcmp(s, p, seg.n) != 0)
+			return NONE;
+		s += seg.n;
+	} else while(*p)
 		if(map[*s++] != *p++)
 			return NONE;
 	return follow(s, cont, env);
 }
 
-/* Knuth-Morris-Pratt, adapted from Corman-Leiserson-Rivest */
-Kmp::Kmp(Seg seg, int *flags) : String(seg)
+/* Find searches for the leading string.  it looks with
+   memchr for one byte of the string, chosen to be rare and
+   preferably unaffected by REG_ICASE, then checks the last
+   byte and the rest.  if candidates are too many for the
+   ground covered, it switches to Knuth-Morris-Pratt, which
+   is linear however many there are */
+
+static int
+common(int c)		// crude frequency in text
 {
-	type = KMP;
+	static const char often[] = " etaoinsrhl";
+	if(c == 0)
+		return 0;
+	if(strchr(often, c) || (c>='A' && c<='Z' &&
+	   strchr(often, c-'A'+'a')))
+		return 2;
+	return (c>='a' && c<='z') || (c>='A' && c<='Z');
+}
+
+Find::Find(Seg seg, uchar *map, int *flags) : String(seg)
+{
+	type = FIND;
 	if(fail.assure(seg.n)) {
 		*flags |= SPACE;
 		return;
 	}
-	int q, k ;
+	int i, q, k;
+	int best = INT_MAX;
+	int count[UCHAR_MAX+1];		// bytes that map to each
+	memset(count, 0, sizeof(count));
+	for(i=0; i<=UCHAR_MAX; i++)
+		count[map[i]]++;
+	at = 0;
+	for(q=0; q<seg.n; q++) {
+		int n = 3*count[seg.p[q]] + common(seg.p[q]);
+		if(n < best) {
+			best = n;
+			at = q;
+		}
+	}
+	for(nb=i=0; i<=UCHAR_MAX; i++)
+		if(map[i] == seg.p[at] && nb++ < 2)
+			b[nb-1] = i;
+	if(nb > 2)
+		nb = 0;
+			/* Knuth-Morris-Pratt, adapted from
+			   Corman-Leiserson-Rivest */
 	fail[0] = k = -1;
 	for(q=1; q<seg.n; q++) {
 		while(k>=0 && seg.p[k+1] != seg.p[q])
@@ -474,99 +679,656 @@ Kmp::Kmp(Seg seg, int *flags) : String(seg)
 		fail[q] = k;
 	}
 }
-int Kmp::parse(uchar *s, Rex* cont, Eenv *env)
+
+/* the next place at or after t where the chosen byte
+   could begin a match ending by last.  when there are two
+   bytes to look for, hit holds where each was last seen */
+
+uchar *Find::next(uchar *t, uchar *last, uchar *map, uchar **hit)
+{
+	uchar *lo = t + at;
+	uchar *hi = last - seg.n + at + 1;
+	uchar *h;
+	if(lo >= hi)
+		return 0;
+	switch(nb) {
+	case 1:
+		h = (uchar*)memchr(lo, b[0], hi-lo);
+		break;
+	case 2:
+		for(int i=0; i<2; i++)
+			if(hit[i] < lo) {
+				hit[i] = (uchar*)memchr(lo, b[i], hi-lo);
+				if(hit[i] == 0)
+					hit[i] = hi;
+			}
+		h = hit[0]<hit[1]? hit[0]: hit[1];
+		if(h >= hi)
+			h = 0;
+		break;
+	default:
+		for(h=lo; h<hi; h++)
+			if(map[*h] == seg.p[at])
+				break;
+		if(h >= hi)
+			h = 0;
+	}
+	return h? h-at: 0;
+}
+
+int Find::parse(uchar *s, Rex* cont, Eenv *env)
 {
-	debug(KMP, "Kmp", s);
+	debug(FIND, "Find", s);
 	uchar *map = env->preg->map;
+	uchar *last = env->last;
+	uchar *hit[2] = { 0, 0 };
 	uchar *t = s;
+	uchar *p = seg.p;
+	int n = seg.n;
+	long work = 0;
+	for(;;) {
+		if(work > 2*(t-s) + 8*n)
+			return kmp(s, t, cont, env);
+		if((t = next(t, last, map, hit)) == 0)
+			return NONE;
+		work++;
+		int i = n - 1;
+		if(map[t[i]] == p[i]) {
+			work += n;
+			while(--i >= 0 && map[t[i]] == p[i])
+				continue;
+		}
+		if(i < 0) {
+			env->best[0].rm_so = t - s;
+			switch(follow(t+n, cont, env)) {
+			case GOOD:
+			case BEST:
+				return BEST;
+			case BAD:
+				return BAD;
+			}
+		}
+		t++;
+	}
+}
+
+/* after a failed continuation, resume in the state for
+   the longest proper suffix of the match, without looking
+   at its bytes again */
+
+int Find::kmp(uchar *s, uchar *t, Rex* cont, Eenv *env)
+{
+	uchar *map = env->preg->map;
 	uchar *last = env->last;
-	while(t+seg.n <= last) {
-		int k = -1;
-		for( ; t<last; t++) {
-			while(k>=0 && seg.p[k+1] != map[*t])
-				k = fail[k];
-			if(seg.p[k+1] == map[*t])
-				k++;
-			if(k+1 == seg.n) {
-				env->best[0].rm_so = ++t - s - seg.n;
-				switch(follow(t, cont, env)) {
-				case GOOD:
-				case BEST:
-					return BEST;
-				case BAD:
-					return BAD;
-				}
-				t -= seg.n - 1;
-				break;
+	int k = -1;
+	for( ; t<last; t++) {
+		while(k>=0 && seg.p[k+1] != map[*t])
+			k = fail[k];
+		if(seg.p[k+1] == map[*t])
+			k++;
+		if(k+1 == seg.n) {
+			env->best[0].rm_so = t+1 - s - seg.n;
+			switch(follow(t+1, cont, env)) {
+			case GOOD:
+			case BEST:
+				return BEST;
+			case BAD:
+				return BAD;
 			}
+			k = fail[k];
 		}
 	}
 	return NONE;
-}	
+}
 
 
 int Trie::parse(uchar *s, Rex *contin, Eenv *env)
 {
-	Tnode *node = root[env->preg->map[*s]&MASK];
-	if(node==0 || s+min>env->last)
+	if(s>=env->last || s+min>env->last)
 		return NONE;
-	return parse(node, s, contin, env);
+	int i = root[env->preg->map[*s]&MASK];
+	if(i == 0)
+		return NONE;
+	return parse(i, s, contin, env);
 }
-int Trie::parse(Tnode *node, uchar *s, Rex* contin, Eenv *env)
+int Trie::parse(int i, uchar *s, Rex* contin, Eenv *env)
 {
 	debug(TRIE, "Trie", s);
 	uchar *map = env->preg->map;
+	Tnode *t;
 	for(;;) {
 		if(s >= env->last)
 			return NONE;
-		while(node->c != map[*s]) {
-			node = node->sib;
-			if(node == 0)
+		while((t = &node[i])->c != map[*s]) {
+			i = t->sib;
+			if(i == 0)
 				return NONE;
 		}
-		if(node->end)
+		if(t->end)
 			break;
-		node = node->son;
+		i = t->son;
 		s++;
 	}
 	int longresult = NONE;
-	if(node->son)
-		longresult = parse(node->son, s+1, contin, env);
+	if(t->son)
+		longresult = parse(t->son, s+1, contin, env);
 	if(longresult==BEST || longresult==BAD)
 		return longresult;
 	int shortresult = follow(s+1, contin, env);
 	return shortresult==NONE? longresult: shortresult;
 }
+int Trie::newnode(int c)
+{
+	if(node.assure(nnode+1))
+		return 0;
+	Tnode *t = &node[++nnode];
+	t->c = c;
+	t->end = 0;
+	t->son = t->sib = t->fail = t->out = 0;
+	t->dense = -1;
+	return nnode;
+}
 /* returns 1 if out of space
    string s must be nonempty */
 int Trie::insert(uchar *s)
 {
-	int len;
-	Tnode *node = root[*s&MASK];
-	if(node == 0)
-		node = root[*s&MASK] = new Tnode(*s);
-	for(len=1; ; ) {
-		if(node == 0)
+	int len, i, j;
+	i = root[*s&MASK];
+	if(i == 0) {
+		if((i = newnode(*s)) == 0)
 			return 1;
-		if(node->c == *s) {
+		root[*s&MASK] = i;
+	}
+	for(len=1; ; ) {
+		if(node[i].c == *s) {
 			if(s[1] == 0)
 				break;
-			if(node->son == 0)
-				node->son = new Tnode(s[1]);
-			node = node->son;
+			if(node[i].son == 0) {
+				if((j = newnode(s[1])) == 0)
+					return 1;
+				node[i].son = j;
+			}
+			i = node[i].son;
 			len++;
 			s++;
 		} else {
-			if(node->sib == 0)
-				node->sib = new Tnode(*s);
-			node = node->sib;
+			if(node[i].sib == 0) {
+				if((j = newnode(*s)) == 0)
+					return 1;
+				node[i].sib = j;
+			}
+			i = node[i].sib;
 		}	
 	}
 	if(len < min)
 		min = len;
-	else if(len > max)
+	if(len > max)
 		max = len;
-	node->end = 1;
+	node[i].end = 1;
+	ac = 0;
+	return 0;
+}
+
+/* lay the nodes out again breadth first, each sib list
+   together.  returns 1 if out of space */
+
+int Trie::pack()
+{
+	Array<int> order, renum;
+	Array<Tnode> temp;
+	int i, j, k, n = 0;
+	if(order.assure(nnode+1) || renum.assure(nnode+1) ||
+	   temp.assure(nnode+1))
+		return 1;
+	order[n++] = 0;
+	renum[0] = 0;
+	for(i=0; i<NROOT; i++)
+		for(j=root[i]; j; j=node[j].sib) {
+			renum[j] = n;
+			order[n++] = j;
+		}
+	for(k=1; k<n; k++)
+		for(j=node[order[k]].son; j; j=node[j].sib) {
+			renum[j] = n;
+			order[n++] = j;
+		}
+	for(k=1; k<n; k++) {
+		temp[k] = node[order[k]];
+		temp[k].son = renum[temp[k].son];
+		temp[k].sib = renum[temp[k].sib];
+	}
+	memmove(&node[1], &temp[1], (n-1)*sizeof(Tnode));
+	for(i=0; i<NROOT; i++)
+		root[i] = renum[root[i]];
+	return 0;
+}
+
+int Trie::child(int q, int c)
+{
+	if(q && node[q].dense>=0)
+		return table[node[q].dense*NROOT + c];
+	int i = q? node[q].son: root[c&MASK];
+	while(i && node[i].c != c)
+		i = node[i].sib;
+	return i;
+}
+
+/* build the Aho-Corasick links breadth first, so the failure
+   of a node is ready before its sons' are needed.  a null
+   link means the root.  nodes with many sons get a table
+   for child(), to save walking long sib lists in find().
+   after pack() the breadth-first order is the node order.
+   returns 1 if out of space */
+
+int Trie::link()
+{
+	int i, n, u, v, f, w, ntable = 0;
+	Array<int> depth;
+	if(depth.assure(nnode+1))
+		return 1;
+	for(i=0; i<NROOT; i++)
+		for(v=root[i]; v; v=node[v].sib) {
+			node[v].fail = 0;
+			node[v].out = node[v].end;
+			depth[v] = 1;
+		}
+	for(u=1; u<=nnode; u++) {
+		int d = depth[u] + 1;
+		for(n=0, v=node[u].son; v; v=node[v].sib)
+			n++;
+		node[u].dense = -1;
+		if(n >= DENSE) {
+			if(table.assure((ntable+1)*NROOT))
+				return 1;
+			memset(&table[ntable*NROOT], 0, NROOT*sizeof(int));
+			for(v=node[u].son; v; v=node[v].sib)
+				table[ntable*NROOT + node[v].c] = v;
+			node[u].dense = ntable++;
+		}
+		for(v=node[u].son; v; v=node[v].sib) {
+			for(f=node[u].fail; ; f=node[f].fail) {
+				w = child(f, node[v].c);
+				if(w || f==0)
+					break;
+			}
+			node[v].fail = w;
+			node[v].out = node[v].end? d: w? node[w].out: 0;
+			depth[v] = d;
+		}
+	}
+	return 0;
+}
+
+/* share identical subtries, bottom up: after pack() the
+   son and sib of a node come after it.  a node is the same
+   as another if c, end and the (already shared) son and sib
+   are.  the survivors are then renumbered in order.
+   returns 1 if out of space */
+
+int Trie::merge()
+{
+	Array<int> canon, hash;
+	int i, j, h, n, size = 1;
+	while(size < 2*nnode)
+		size *= 2;
+	if(canon.assure(nnode+1) || hash.assure(size))
+		return 1;
+	memset(&hash[0], 0, size*sizeof(int));
+	canon[0] = 0;
+	for(i=nnode; i>0; i--) {
+		Tnode *t = &node[i];
+		t->son = canon[t->son];
+		t->sib = canon[t->sib];
+		h = ((t->son*31 + t->sib)*31 + t->c)*2 + t->end;
+		for(h&=size-1; (j=hash[h]) != 0; h=(h+1)&(size-1))
+			if(node[j].c==t->c && node[j].end==t->end &&
+			   node[j].son==t->son && node[j].sib==t->sib)
+				break;
+		if(j == 0)
+			hash[h] = j = i;
+		canon[i] = j;
+	}
+	hash[0] = 0;		// now the new index of a survivor
+	for(n=0, i=1; i<=nnode; i++)
+		if(canon[i] == i) {
+			hash[i] = ++n;
+			node[n] = node[i];
+		}
+	for(i=1; i<=nnode; i++)
+		canon[i] = hash[canon[i]];
+	for(i=1; i<=n; i++) {
+		node[i].son = canon[node[i].son];
+		node[i].sib = canon[node[i].sib];
+	}
+	for(i=0; i<NROOT; i++)
+		root[i] = canon[root[i]];
+	nnode = n;
+	merged = 1;
+	return 0;
+}
+
+/* gather into p the distinct prefixes of length m, m bytes
+   apiece, from the sib list at i, d bytes deep along path.
+   returns 1 if there are too many for a Teddy */
+
+int Trie::prefixes(int i, uchar *path, int d, int m,
+	Array<uchar> &p, int &n)
+{
+	for( ; i; i=node[i].sib) {
+		path[d] = node[i].c;
+		if(d+1 < m) {
+			if(prefixes(node[i].son, path, d+1, m, p, n))
+				return 1;
+		} else {
+			if(n>=Teddy::NPREFIX || p.assure((n+1)*m))
+				return 1;
+			memmove(&p[n++*m], path, m);
+		}
+	}
+	return 0;
+}
+
+/* get ready for parse() and find(), once all words are in.
+   once says that the trie is only tried at the beginning */
+
+void Trie::ready(int once, uchar *map)
+{
+	uchar path[Teddy::NBYTE];
+	Array<uchar> p;
+	int i, n = 0;
+	int m = min<Teddy::NBYTE? min: Teddy::NBYTE;
+	delete teddy;
+	teddy = 0;
+	ac = 2;
+	if(pack())
+		return;
+	if(once) {
+		if(2*nnode > Prog::MAXINST)
+			merge();
+		return;
+	}
+	if(link() == 0)
+		ac = 1;
+	for(i=0; i<NROOT; i++)
+		if(prefixes(root[i], path, 0, m, p, n))
+			return;
+	teddy = new Teddy(&p[0], n, m, map);
+}
+
+/* 1 if a word begins at s */
+
+int Trie::begins(uchar *s, uchar *last, uchar *map)
+{
+	int i = root[map[*s]&MASK];
+	for( ; i && s<last; s++) {
+		while(node[i].c != map[*s])
+			if((i = node[i].sib) == 0)
+				return 0;
+		if(node[i].end)
+			return 1;
+		i = node[i].son;
+	}
+	return 0;
+}
+
+/* the leftmost place at or after s where a word begins,
+   or 0.  a Teddy proposes places for begins() to check.
+   otherwise once a word has been seen, scanning stops when
+   no longer word could begin earlier.  if there are no
+   links, s is returned, for parse() to try */
+
+uchar *Trie::find(uchar *s, uchar *last, uchar *map)
+{
+	if(teddy) {
+		for( ; (s = teddy->find(s, last)) != 0; s++)
+			if(begins(s, last, map))
+				return s;
+		return 0;
+	}
+	if(ac != 1)
+		return s;
+	int q = 0, v;
+	uchar *best = 0;
+	for(uchar *t=s; t<last; t++) {
+		if(best && t-best >= max-1)
+			break;
+		int c = map[*t];
+		for(;;) {
+			v = child(q, c);
+			if(v || q==0)
+				break;
+			q = node[q].fail;
+		}
+		q = v;
+		if(q && node[q].out && (best==0 || t+1-node[q].out < best))
+			best = t+1 - node[q].out;
+	}
+	return best;
+}
+
+/* whether Teddy::find may use SIMD shuffles here */
+
+static int
+shuffles()
+{
+#ifdef SHUFFLE
+	return __builtin_cpu_supports("ssse3") != 0;
+#else
+	return 0;
+#endif
+}
+
+/* a saved Trie: a Thead, then node[0..nnode], then the
+   tables, then the Teddy if any, each part aligned */
+
+struct Thead {
+	int min, max;
+	int nnode;
+	int ntable;		// tables of sons, NROOT ints apiece
+	uchar ac;
+	uchar merged;
+	uchar teddy;		// a Teddy follows
+	int root[Trie::NROOT];
+};
+
+/* lay the trie out in buf, once it is ready, if n bytes
+   are enough.  returns how many it takes */
+
+size_t Trie::save(uchar *buf, size_t n)
+{
+	int i, ntable = 0;
+	for(i=1; i<=nnode; i++)
+		if(node[i].dense >= ntable)
+			ntable = node[i].dense + 1;
+	size_t tnode = align8(sizeof(Thead));
+	size_t ttable = tnode + align8((nnode+1)*sizeof(Tnode));
+	size_t tteddy = ttable + align8(ntable*NROOT*sizeof(int));
+	size_t size = tteddy + (teddy? align8(sizeof(Teddy)): 0);
+	if(buf==0 || n<size)
+		return size;
+	Thead *h = (Thead*)buf;
+	memset(buf, 0, size);
+	h->min = min;
+	h->max = max;
+	h->nnode = nnode;
+	h->ntable = ntable;
+	h->ac = ac;
+	h->merged = merged;
+	h->teddy = teddy != 0;
+	memmove(h->root, root, sizeof(root));
+	memmove(buf+tnode, &node[0], (nnode+1)*sizeof(Tnode));
+	if(ntable)
+		memmove(buf+ttable, &table[0], ntable*NROOT*sizeof(int));
+	if(teddy)
+		memmove(buf+tteddy, teddy, sizeof(Teddy));
+	return size;
+}
+
+/* whether the nodes and tables save() left in buf are
+   fit to use: every link is to a node there, as pack()
+   orders them, so no walk can leave the trie or go round
+   in it, and every out is as link() would have made it.
+   a damaged file must not make find() read astray */
+
+static int
+checktrie(Thead *h, Trie::Tnode *node, int *table, Teddy *teddy)
+{
+	int i, k, c, n = h->nnode;
+	Array<int> depth;
+	if(h->min<0 || (n>0 && h->min>h->max) || depth.assure(n))
+		return 1;
+	for(i=0; i<=n; i++)
+		depth[i] = 0;
+	for(c=0; c<Trie::NROOT; c++) {
+		if(h->root[c]<0 || h->root[c]>n)
+			return 1;
+		depth[h->root[c]] = 1;
+	}
+	for(i=1; i<=n; i++) {
+		Trie::Tnode *t = &node[i];
+		if(t->son<0 || t->son>n || (t->son && t->son<=i) ||
+		   t->sib<0 || t->sib>n || (t->sib && t->sib<=i) ||
+		   t->dense<-1 || t->dense>=h->ntable)
+			return 1;
+		if(depth[i] == 0)	// reached from no earlier node
+			depth[i] = INT_MAX;
+		if(t->son)
+			depth[t->son] = depth[i]==INT_MAX? INT_MAX: depth[i]+1;
+		if(t->sib)
+			depth[t->sib] = depth[i];
+		if(h->ac != 1)
+			continue;
+		if(t->fail<0 || t->fail>=i || depth[i]==INT_MAX ||
+		   t->out != (t->end? depth[i]:
+			      t->fail? node[t->fail].out: 0))
+			return 1;
+	}
+	for(k=0; k<h->ntable*Trie::NROOT; k++)
+		if(table[k]<0 || table[k]>n)
+			return 1;
+	if(teddy && (teddy->m<1 || teddy->m>Teddy::NBYTE))
+		return 1;
+	return 0;
+}
+
+/* take the trie that save() left in buf, using the nodes
+   and tables where they are.  returns 1 if the n bytes
+   don't hold a sound one or memory runs out */
+
+int Trie::map(uchar *buf, size_t n)
+{
+	Thead *h = (Thead*)buf;
+	if(n < sizeof(Thead) || h->nnode<0 || h->ntable<0 ||
+	   h->ntable>h->nnode)
+		return 1;
+	size_t tnode = align8(sizeof(Thead));
+	size_t ttable = tnode + align8(((size_t)h->nnode+1)*sizeof(Tnode));
+	size_t tteddy = ttable +
+		align8((size_t)h->ntable*NROOT*sizeof(int));
+	size_t size = tteddy + (h->teddy? align8(sizeof(Teddy)): 0);
+	if(n<size || checktrie(h, (Tnode*)(buf+tnode), (int*)(buf+ttable),
+	   h->teddy? (Teddy*)(buf+tteddy): 0))
+		return 1;
+	min = h->min;
+	max = h->max;
+	nnode = h->nnode;
+	ac = h->ac;
+	merged = h->merged;
+	memmove(root, h->root, sizeof(root));
+	mapped = 1;
+	node.p = (Tnode*)(buf+tnode);
+	node.size = nnode + 1;
+	if(h->ntable) {
+		table.p = (int*)(buf+ttable);
+		table.size = h->ntable*NROOT;
+	}
+	if(h->teddy) {		// copied, for simd on this machine
+		teddy = new Teddy(*(Teddy*)(buf+tteddy));
+		if(teddy == 0)
+			return 1;
+		teddy->simd = shuffles();
+	}
+	return 0;
+}
+
+/* prefixes are dealt to buckets in trie order, so those
+   in a bucket tend to share bytes */
+
+Teddy::Teddy(uchar *p, int n, int m, uchar *map) : m(m)
+{
+	int i, j, c;
+	memset(mask, 0, sizeof(mask));
+	memset(lo, 0, sizeof(lo));
+	memset(hi, 0, sizeof(hi));
+	for(i=0; i<n; i++)
+		for(j=0; j<m; j++)
+			for(c=0; c<=UCHAR_MAX; c++)
+				if(map[c] == p[i*m+j])
+					mask[j][c] |= 1 << i*8/n;
+	for(j=0; j<m; j++)
+		for(c=0; c<=UCHAR_MAX; c++) {
+			lo[j][c&0xf] |= mask[j][c];
+			hi[j][c>>4] |= mask[j][c];
+		}
+	simd = shuffles();
+}
+
+#ifdef SHUFFLE
+
+/* the first candidate in the whole blocks of 16 places
+   from s before e, else the place after those blocks */
+
+__attribute__((target("ssse3")))
+static uchar *
+shuffle(Teddy *t, uchar *s, uchar *e)
+{
+	__m128i lo[Teddy::NBYTE], hi[Teddy::NBYTE];
+	__m128i nibble = _mm_set1_epi8(0xf);
+	__m128i zero = _mm_setzero_si128();
+	int j;
+	for(j=0; j<t->m; j++) {
+		lo[j] = _mm_loadu_si128((__m128i*)t->lo[j]);
+		hi[j] = _mm_loadu_si128((__m128i*)t->hi[j]);
+	}
+	for( ; e-s >= 16; s+=16) {
+		__m128i r = _mm_set1_epi8(-1);
+		for(j=0; j<t->m; j++) {
+			__m128i c = _mm_loadu_si128((__m128i*)(s+j));
+			__m128i l = _mm_and_si128(c, nibble);
+			__m128i h = _mm_and_si128(_mm_srli_epi16(c, 4),
+					nibble);
+			r = _mm_and_si128(r, _mm_shuffle_epi8(lo[j], l));
+			r = _mm_and_si128(r, _mm_shuffle_epi8(hi[j], h));
+		}
+		int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(r, zero));
+		if(bits != 0xffff)
+			return s + __builtin_ctz(~bits);
+	}
+	return s;
+}
+
+#endif
+
+/* the first candidate at or after s with m bytes before
+   last, or 0.  the nibble masks let through more than mask
+   does, so their candidates are checked again */
+
+uchar *Teddy::find(uchar *s, uchar *last)
+{
+	if(last - s < m)
+		return 0;
+	uchar *e = last - m + 1;
+	for( ; s<e; s++) {
+#ifdef SHUFFLE
+		if(simd && e-s >= 16 && (s = shuffle(this, s, e)) >= e)
+			return 0;
+#endif
+		int j, b = 0xff;
+		for(j=0; j<m && b; j++)
+			b &= mask[j][s[j]];
+		if(b)
+			return s;
+	}
 	return 0;
 }
 
@@ -760,9 +1522,22 @@ struct Rep1 : Rex {
 		next = ref->next; serial=ref->serial; }
 	int parse(uchar *, Rex*, Eenv*);
 };
+/* at a memo point, iterations beyond lo begin in the same
+   way whatever the path by which they were reached.  so if
+   one fails at some place, so will every other there.
+   only failures are remembered; success may depend on
+   better() */
+
 int Rep::dorep(int n, uchar *s, Rex *cont, Eenv *env)
 {
 	int result = NONE;
+	int bit = -1;
+	if(memo>=0 && n>=lo && env->memosize) {
+		bit = (s-env->p)*env->preg->nmemo + memo;
+		if(*memobyte(env->memo, env->memosize, env->memoclear,
+		   bit) & 1<<(bit%CHAR_BIT))
+			return NONE;
+	}
 	if(hi > n) {
 		Rep1 rep1(this, s, n+1, cont);
 		Save save(n1, n2, env);
@@ -780,7 +1555,12 @@ int Rep::dorep(int n, uchar *s, Rex *cont, Eenv *env)
 		return BAD;
 	int res1 = follow(s, cont, env);
 	env->poppos();
-	return res1==NONE? result: res1;
+	if(res1 != NONE)
+		return res1;
+	if(result==NONE && bit>=0)
+		*memobyte(env->memo, env->memosize, env->memoclear, bit) |=
+			1<<(bit%CHAR_BIT);
+	return result;
 }
 int Rep1::parse(uchar *s, Rex*, Eenv *env)
 {
@@ -957,33 +1737,244 @@ int Done::parse(uchar *s, Rex*, Eenv *env)
 	return GOOD;
 }
 
+/* the first place at or after s where a match could begin,
+   given that the must literal occurs there, or 0 */
+
+uchar *Must::find(uchar *s, uchar *last)
+{
+	uchar *t = s;
+	if(off > 0) {
+		if(last - s < off)
+			return 0;
+		t += off;
+	}
+	t = (uchar*)memmem(t, last-t, seg.p, seg.n);
+	if(t == 0)
+		return 0;
+	return off<0? s: t-off;
+}
+
+/* the first place at or after s, in a string that begins
+   at base, where a match could begin, or 0 */
+
+uchar *Start::find(uchar *s, uchar *base, uchar *last)
+{
+	for(;;) {
+		if(nl && s>base && s[-1]!='\n') {
+			s = (uchar*)memchr(s, '\n', last-s);
+			if(s == 0)
+				return 0;
+			s++;
+		}
+		if(last-s < min)
+			return 0;
+		if(any)
+			return s;
+		if(nl) {
+			if(s < last && first.in(*s))
+				return s;
+			if(++s > last)
+				return 0;
+			continue;
+		}
+		uchar *e = last - (min>0? min-1: 0);
+		if(one >= 0)
+			return (uchar*)memchr(s, one, e-s);
+		for( ; s<e; s++)
+			if(first.in(*s))
+				return s;
+		return 0;
+	}
+}
+
+/* where the backtracker next need try, satisfying trie,
+   start and must, or 0 */
+
+uchar *
+candidate(Trie *trie, Must *must, Start *start, uchar *s, uchar *base,
+	uchar *last, uchar *map)
+{
+	uchar *t;
+	for(;;) {
+		if(trie && (s = trie->find(s, last, map)) == 0)
+			return 0;
+		t = s;
+		if(start && (t = start->find(t, base, last)) == 0)
+			return 0;
+		if(must && (t = must->find(t, last)) == 0)
+			return 0;
+		if(t == s)
+			return s;
+		s = t;
+	}
+}
+
 /* regnexec is a side door for use when string length is known.
    returning REG_BADPAT or REG_ESPACE is not explicitly
     countenanced by the standard. */
 
 int regnexec(const regex_t *preg, const char *string, size_t len,
 	     size_t nmatch, regmatch_t *match, int eflags)
+{
+	Ctx temp;
+	return regctxexec(preg, &temp, string, len, nmatch, match, eflags);
+}
+
+regctx_t *regctxalloc()
+{
+	return new Ctx;
+}
+
+void regctxfree(regctx_t *ctx)
+{
+	delete ctx;
+}
+
+void regctxlimit(regctx_t *ctx, size_t limit)
+{
+	ctx->limit = limit;
+}
+
+void regctxbudget(regctx_t *ctx, unsigned long steps, unsigned long msec)
+{
+	ctx->steps = steps;
+	ctx->msec = msec;
+}
+
+enum { TICK = 1<<12 };	// steps between readings of the clock
+
+Budget::Budget(Ctx *ctx) : steps(ctx->steps), counted(ctx->steps!=0),
+	timed(ctx->msec!=0)
+{
+	if(timed) {
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		sec = t.tv_sec + ctx->msec/1000;
+		nsec = t.tv_nsec + ctx->msec%1000*1000000;
+		if(nsec >= 1000000000) {
+			sec++;
+			nsec -= 1000000000;
+		}
+	}
+	arm();
+}
+
+void Budget::arm()
+{
+	left = timed? (unsigned long)TICK: ULONG_MAX;
+	if(counted) {
+		if(left > steps)
+			left = steps;
+		steps -= left;
+	}
+}
+
+/* left has run out: say whether the budget has, and if not
+   count down another stretch.  once spent, it stays so */
+
+int Budget::over()
+{
+	if(counted && steps == 0) {
+		left = 1;
+		return 1;
+	}
+	if(timed) {
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		if(t.tv_sec > sec || (t.tv_sec == sec && t.tv_nsec >= nsec)) {
+			counted = 1;
+			steps = 0;
+			left = 1;
+			return 1;
+		}
+	}
+	arm();
+	return 0;
+}
+
+/* regnexec, with scratch space that persists in ctx.  only
+   a null ctx costs a Ctx made and unmade for the call */
+
+int regctxexec(const regex_t *preg, regctx_t *ctx, const char *string,
+	size_t len, size_t nmatch, regmatch_t *match, int eflags)
 {
 	int i;
+	if(ctx == 0)
+		return regnexec(preg, string, len, nmatch, match, eflags);
+	Must *must = preg->must;
+	Start *start = preg->start;
+	Trie *trie = 0;		// to scan for
+	Prog *prog = preg->prog;
+	uchar *s = (uchar*)string;
 	if(preg->rex == 0)	// not required, but kind
 		return REG_BADPAT;
-	Eenv env(preg, eflags, (uchar*)string, len);
+	if(__atomic_load_n(&preg->flags, __ATOMIC_ACQUIRE) & STALE)
+		prog = ready((regex_t*)preg);
+	if(start && len < (size_t)start->min)
+		return REG_NOMATCH;
+	if(must && (s = must->find(s, s+len)) == 0)
+		return REG_NOMATCH;
+	if(!(preg->flags&ONCE) && preg->rex->type==TRIE)
+		trie = (Trie*)preg->rex;
+	if(trie && trie->teddy) {	// quick enough to go first
+		s = trie->find(s, (uchar*)string+len, preg->map);
+		if(s == 0)
+			return REG_NOMATCH;
+		if(preg->rex->next==0 &&
+		   (nmatch==0 || preg->flags&REG_NOSUB))
+			return 0;
+	}
+	if(prog && (nmatch==0 || preg->flags&REG_NOSUB))
+		switch(prog->dfaexec((uchar*)string, (uchar*)string+len,
+				preg->flags | (eflags&EFLAGS))) {
+		case 0:
+			return REG_NOMATCH;
+		case 1:
+			return 0;
+		}		// else busy; any parse will do
+	else if(prog && (i = prog->tagexec((uchar*)string, len,
+			nmatch, match, eflags&EFLAGS, ctx)) >= 0)
+		return i;
+	else if(prog && preg->flags&HARD)
+		return prog->pikeexec((uchar*)string, len,
+				nmatch, match, eflags&EFLAGS, ctx);
+	if(prog)
+		return backexec(preg, ctx, (uchar*)string, len,
+				s, nmatch, match, eflags&EFLAGS);
+	Eenv env(preg, eflags, (uchar*)string, len, ctx);
 	if(env.flags&SPACE)
 		return REG_ESPACE;
 	if(env.flags&REG_NOSUB)
 		nmatch = 0;
-	for(i=0; (unsigned)i<nmatch && (unsigned)i<=preg->re_nsub; i++)
+	for(i=0; (unsigned)i<=preg->re_nsub; i++)
 		env.match[i] = NOMATCH;
 
-	while(preg->rex->parse((uchar*)string,Done::done,&env) == NONE) {
+	if(env.flags & ONCE) {
+		s = (uchar*)string;
+		must = 0;
+		start = 0;
+	} else if(must && must->off<0) {
+		s = (uchar*)string;
+		must = 0;	// else skip to its candidates
+	}
+	for(;;) {
+		s = candidate(trie, must, start, s, (uchar*)string,
+			env.last, preg->map);
+		if(s == 0)
+			return REG_NOMATCH;
+		env.best[0].rm_so = s - (uchar*)string;
+		if(preg->rex->parse(s,Done::done,&env) != NONE ||
+		   env.flags&SPENT)
+			break;
 		if(env.flags & ONCE)
 			return REG_NOMATCH;
-		if((uchar*)++string > env.last)
+		if(++s > env.last)
 			return REG_NOMATCH;
-		env.best[0].rm_so++;
 	}
 	if(env.flags & SPACE)
 		return REG_ESPACE;
+	if(env.flags & SPENT)
+		return REG_EBUDGET;
 
 	for(i=0; (unsigned)i<nmatch; i++)
 		if((unsigned)i <= preg->re_nsub)
@@ -993,6 +1984,55 @@ int regnexec(const regex_t *preg, const char *string, size_t len,
 	return 0;
 }
 
+void regiterinit(regiter_t *it, const char *string, size_t len,
+	int eflags)
+{
+	it->ri_s = string;
+	it->ri_len = len;
+	it->ri_at = 0;
+	it->ri_flags = eflags;
+}
+
+/* the next match of an iteration, with offsets from the
+   start of the subject.  it is sought from where the last
+   ended, or a byte on if that was empty, in the rest of
+   the subject only, so each match costs about what it
+   reads.  ^ matches there if it would in the whole */
+
+int regiterexec(const regex_t *preg, regctx_t *ctx, regiter_t *it,
+	size_t nmatch, regmatch_t *match)
+{
+	regmatch_t m0;
+	size_t i, at = it->ri_at;
+	int r, eflags = it->ri_flags;
+	if(preg->flags & REG_NOSUB)
+		return REG_BADPAT;
+	if(at > it->ri_len)
+		return REG_NOMATCH;
+	if(nmatch == 0) {
+		nmatch = 1;
+		match = &m0;
+	}
+	if(at > 0) {
+		eflags &= ~REG_NOTBOL;
+		if(!(preg->flags&REG_NEWLINE && it->ri_s[at-1]=='\n'))
+			eflags |= REG_NOTBOL;
+	}
+	r = regctxexec(preg, ctx, it->ri_s+at, it->ri_len-at,
+		nmatch, match, eflags);
+	if(r != 0) {
+		it->ri_at = it->ri_len + 1;
+		return r;
+	}
+	for(i=0; i<nmatch; i++)
+		if(match[i].rm_so >= 0) {
+			match[i].rm_so += at;
+			match[i].rm_eo += at;
+		}
+	it->ri_at = match[0].rm_eo + (match[0].rm_so==match[0].rm_eo);
+	return 0;
+}
+
 int regexec(const regex_t *preg, const char *string, size_t nmatch,
 	    regmatch_t *match, int eflags)
 {
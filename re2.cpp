@@ -100,6 +100,21 @@ init()
 	}
 }
 
+/* records kept by stat() for deciding which Reps
+   may be memo points.  ticks tell where things lie
+   in the pattern relative to each other */
+
+struct Mrep {
+	Rep *rep;
+	int tick0, tick1;	// ticks at start and end of rep
+	int n0, n1;		// subexpressions begun by then
+};
+
+struct Mback {
+	int n;			// subexpression referred to
+	int tick;
+};
+
 /* compilation environment, one static copy would do were it
    not for threads */
 
@@ -114,13 +129,23 @@ struct Cenv {
 	uchar retype;	// BRE, ERE, or ARE
 	uchar paren[BACK_REF_MAX+1];// paren[i] is 1 if \i is defined
 	int posixkludge;// used by token() to make * nonspecial
-	Cenv(const char *pattern, int cflags);
-	Cenv(int cflags) : flags(cflags) { }	// short form
+	int nest;	// Reps, Negs and Conjs around stat() node
+	int nopen;	// subexpressions begun before stat() node
+	int tick;	// Reps and Backs seen by stat()
+	Array<Mrep> mrep;// possible memo points
+	int nmrep;
+	Array<Mback> mback;// backreferences
+	int nmback;	// or -1 if too many to keep
+	Arena *arena;	// where the nodes go
+	Cenv(const char *pattern, int cflags, Arena *arena);
+	Cenv(int cflags, Arena *arena) :	// short form
+		flags(cflags), arena(arena) { }
 };
 
-Cenv::Cenv(const char *pattern, int cflags) : flags(cflags),
-	parno(0), parnest(0), backref(0),
-	cursor(Seg((uchar*)pattern, strlen(pattern)))
+Cenv::Cenv(const char *pattern, int cflags, Arena *arena) :
+	flags(cflags), cursor(Seg((uchar*)pattern, strlen(pattern))),
+	parno(0), parnest(0), backref(0), nest(0), nopen(0), tick(0),
+	nmrep(0), nmback(0), arena(arena)
 {
 	if(fold[UCHAR_MAX] == 0)
 		init();
@@ -147,7 +172,7 @@ printnew(Rex *rex)
 		t==DOT? "DOT":
 		t==ONECHAR? "ONECHAR":
 		t==STRING? "STRING":
-		t==KMP? "KMP":
+		t==FIND? "FIND":
 		t==KR? "KR":
 		t==TRIE? "TRIE":
 		t==CLASS? "CLASS":
@@ -166,15 +191,67 @@ static Rex *ERROR = 0;
 
 Rex *NEWinit(Rex *rex, Cenv *env)
 {
+	Arena *a = env->arena;
+	if(rex == 0 || a->own.assure(a->nown)) {
+		env->flags |= SPACE;
+		return ERROR;
+	}
 	if(cdebug)
 		printnew(rex);
-	if(env->flags&SPACE) {
-		delete rex;
-		return ERROR;
-	} else
-		return rex;
+	a->own[a->nown++] = rex;
+	return env->flags&SPACE? ERROR: rex;
+}
+#define NEW(x) NEWinit(new(env->arena) x, env)
+
+/* big requests get a block to themselves, so as not to
+   waste what is left of the newest */
+
+void *Arena::alloc(size_t n)
+{
+	const size_t align = sizeof(double) > sizeof(void*)?
+			sizeof(double): sizeof(void*);
+	n = (n + align-1) & ~(align-1);
+	if(n <= left) {
+		left -= n;
+		p += n;
+		return p - n;
+	}
+	size_t size = n>BLOCK/4? n: (size_t)BLOCK;
+	Block *b = (Block*)malloc(align + size);
+	if(b == 0)
+		return 0;
+	if(n>BLOCK/4 && block) {
+		b->next = block->next;
+		block->next = b;
+	} else {
+		b->next = block;
+		block = b;
+		p = (uchar*)b + align + n;
+		left = size - n;
+	}
+	return (uchar*)b + align;
+}
+
+Seg Arena::copy(Seg s)
+{
+	Seg seg((uchar*)alloc(s.n+1), s.n);
+	if(seg.p) {
+		memmove(seg.p, s.p, (size_t)s.n);
+		seg.p[s.n] = 0;
+	}
+	return seg;
+}
+
+Arena::~Arena()
+{
+	while(nown > 0)
+		own[--nown]->~Rex();
+	while(block) {
+		Block *b = block->next;
+		free(block);
+		block = b;
+	}
 }
-#define NEW(x) NEWinit(new x, env)
 
 /* determine whether greedy matching will work, i.e. produce
    the best match first.  such expressions are "easy", and
@@ -237,10 +314,19 @@ Stat Back::stat(Cenv *env)
 {
 	static Stat backStat;
 	backStat.b = 1;
+	if(env->nmback >= 0) {
+		if(env->mback.assure(env->nmback))
+			env->nmback = -1;
+		else {
+			env->mback[env->nmback].n = n;
+			env->mback[env->nmback++].tick = env->tick++;
+		}
+	}
 	return addStat(backStat, next, env);
 }
 Stat Subexp::stat(Cenv *env)
 {
+	env->nopen = n;
 	Stat st = rex->stat(env);
 	if(env->backref & 1<<n)     // sole reason stat() has env param
 		used = 1;
@@ -260,13 +346,31 @@ Stat Alt::stat(Cenv *env)
 }
 Stat Conj::stat(Cenv *env)
 {
+	env->nest++;
 	Stat st1 = left->stat(env);
-	Stat st = addStat(st1, right, env);
+	Stat st2 = right->stat(env);
+	Stat st = addStat(st1, st2);
+	st.n = st1.n>=st2.n? st1.n: st2.n;
+	env->nest--;
 	return addStat(st, next, env);
 }
+
+/* a Rep{lo,} that is not inside another Rep, Neg or Conj
+   always has the same continuation.  it may be a memo
+   point, as explained at Rep::dorep, depending on the
+   backreferences found later.  */
+
 Stat Rep::stat(Cenv *env)
 {
+	Mrep m = { this, env->tick++, 0, env->nopen, 0 };
+	int top = env->nest++ == 0;
 	Stat st = rex->stat(env);
+	env->nest--;
+	if(top && hi==RE_DUP_INF && env->mrep.assure(env->nmrep)==0) {
+		m.tick1 = env->tick++;
+		m.n1 = env->nopen;
+		env->mrep[env->nmrep++] = m;
+	}
 	if(st.n == 1 && st.c+st.b == 0)
 		st.s++;
 	st.c++;
@@ -277,7 +381,10 @@ Stat Rep::stat(Cenv *env)
 }
 Stat Neg::stat(Cenv *env)
 {
+	env->nest++;
 	Stat st = rex->stat(env);
+	env->nest--;
+	st.n = 0;
 	return addStat(st, next, env);
 }
 Stat String::stat(Cenv *env)
@@ -712,9 +819,9 @@ regbra(Cenv *env)
 	r->icase(env->map);
 	if(neg)
 		r->neg(env->flags);
+	r->nibbles();
 	return r;
 error:
-	delete r;
 	return ERROR;
 }
 
@@ -789,7 +896,6 @@ regRep(Rex *e, int n1, int n2, Cenv *env)
 	}
 	return NEW(Rep((int)m, (int)n, n1, n2, e));
 error:
-	delete e;
 	return ERROR;
 }
 
@@ -799,19 +905,11 @@ error:
 static Rex *
 mkSeq(Rex *e, Rex *f)
 {
-	Rex *g;
-	if(f == ERROR) {
-		delete e;
+	if(f==ERROR || e->type==OK)
 		return f;
-	} else if(e->type == OK) {
-		delete e;
-		return f;
-	} else if(f->type == OK) {
-		g = (Rex*)f->next;
-		f->next = 0;
-		delete f;
-		f = g;
-	} else if(e->type==DOT && f->type==DOT) {
+	else if(f->type == OK)
+		f = (Rex*)f->next;
+	else if(e->type==DOT && f->type==DOT) {
 		unsigned m = ((Dot*)e)->lo + ((Dot*)f)->lo;
 		unsigned n = ((Dot*)e)->hi + ((Dot*)f)->hi;
 		if(m <= RE_DUP_MAX) {
@@ -822,10 +920,7 @@ mkSeq(Rex *e, Rex *f)
 			} else if(n <= RE_DUP_MAX) { // unless ovfl,
 			n_ok:	((Dot*)e)->lo = m;   // combine
 				((Dot*)e)->hi = n;
-				g = (Rex*)f->next;
-				f->next = 0;
-				delete f;
-				f = g;
+				f = (Rex*)f->next;
 			}
 		}
 	}
@@ -850,10 +945,8 @@ regAlt(int n1, Cenv *env) // n1= no. of 1st subexpr in alt
 		return e;
 	eat(env);
 	Rex *f = regAlt(n1, env);
-	if(f == ERROR) {
-		delete e;
+	if(f == ERROR)
 		return f;
-	}
 	Rex *g = regTrie(e, f, env);
 	if(g != ERROR)
 		return g;
@@ -863,8 +956,6 @@ regAlt(int n1, Cenv *env) // n1= no. of 1st subexpr in alt
 	if(g != ERROR)
 		return g;
 bad:
-	delete e;
-	delete f;
 	return ERROR;
 }
 
@@ -883,26 +974,19 @@ regConj(Cenv *env)
 		return e;
 	eat(env);
 	Rex *f = regConj(env);
-	if(f == ERROR) {
-		delete e;
+	if(f == ERROR)
 		return f;
-	}
-	Rex *g = NEW(Conj(e, f));
-	if(g == ERROR){
-		delete e;
-		delete f;
-	}
-	return g;
+	return NEW(Conj(e, f));
 }
 
 /* regTrie tries to combine nontrivial e and f into a Trie. unless
-   ERROR is returned, e and f are deleted as far as possible */
+   ERROR is returned, e and f are no longer needed */
 
 static int
 isstring(Rex *e)
 {
 	switch(e->type) {
-	case KMP:
+	case FIND:
 	case KR:
 	case STRING:
 		return 1;
@@ -916,7 +1000,7 @@ insert(Rex *f, Trie *g)
 {
 	uchar temp[2];
 	switch(f->type) {
-	case KMP:
+	case FIND:
 	case KR:
 	case STRING:
 		 return g->insert(((String*)f)->seg.p);
@@ -939,17 +1023,12 @@ regTrie(Rex *e, Rex *f, Cenv *env)
 			return ERROR;
 		if(insert(f, g))
 			goto nospace;
-	} else if(f->type != TRIE)
+	} else if(f->type!=TRIE || ((Trie*)f)->mapped)
 		return ERROR;
 	if(insert(e, g))
 		goto nospace;
-	delete e;
-	if(f != g)
-		delete f;
 	return g;
 nospace:
-	if(g != f)
-		delete g;
 	return ERROR;
 }
 
@@ -985,21 +1064,19 @@ regSeq(Cenv *env)
 		if(string.n == 0)
 			e = NEW(Ok);
 		else {
-			Seg copy = string.copy();
+			Seg copy = env->arena->copy(string);
 			if(copy.p == 0)
 				return ERROR;
 			e = NEW(String(copy, env->map));
 		}
-		f = NEW(Onechar(env->map[ch]));
+		f = NEW(Onechar(env->map[ch], env->map));
 		f = regRep(f, 0, 0, env);
-		if(f == ERROR) {
-			delete e;
+		if(f == ERROR)
 			return f;
-		}
 		g = regSeq(env);
 		return mkSeq(e, mkSeq(f, g));
 	default:
-		e = NEW(String(string.copy(), env->map));
+		e = NEW(String(env->arena->copy(string), env->map));
 		f = regSeq(env);
 		return mkSeq(e, f);
 	} else if(c > T_BACK) {
@@ -1032,14 +1109,10 @@ regSeq(Cenv *env)
 		e = regAlt(parno+1, env);
 		if(e == ERROR)
 			break;
-		if(e->type==OK && env->flags&REG_EXTENDED) {
-			delete e;
+		if(e->type==OK && env->flags&REG_EXTENDED)
 			return ERROR;
-		} 
-		if(token(env) != T_CLOSE) {
-			delete e;
+		if(token(env) != T_CLOSE)
 			return ERROR;
-		}
 		--env->parnest;
 		eat(env);
 		if(parno <= BACK_REF_MAX)
@@ -1068,7 +1141,7 @@ regSeq(Cenv *env)
 
 /* rewrite the expression tree for some special cases.
    1. it is a null expression - illegal
-   2. it begins with an unanchored string - use KMP algorithm
+   2. it begins with an unanchored string - search for it
    3. it begins with .* or ^ - regexec only need try it ONCE
    4. it begins with one of the above parenthesized and unduplicated
 */		
@@ -1076,7 +1149,7 @@ regSeq(Cenv *env)
 static int
 special(regex_t *preg, Cenv *env)
 {
-	Rex* kmp;
+	Rex* find;
 	Rex* rex = preg->rex;
 	String *string;
 	if(rex == ERROR)
@@ -1098,7 +1171,8 @@ special(regex_t *preg, Cenv *env)
 		}
 	dot:
 	case DOT:			// .*
-		if(((Dot*)rex)->lo==0 && ((Dot*)rex)->hi==RE_DUP_INF)
+		if(((Dot*)rex)->lo==0 && ((Dot*)rex)->hi==RE_DUP_INF &&
+		   !(env->flags & REG_NEWLINE))
 			return ONCE;
 		return 0;
 	case OK:			// empty regexp
@@ -1110,14 +1184,11 @@ special(regex_t *preg, Cenv *env)
 		if(env->flags & (REG_ANCH | REG_LITERAL))
 			return 0;
 		string = (String*)rex;
-		kmp = NEW(Kmp(string->seg, &env->flags));
-		if(kmp==ERROR || env->flags&SPACE) 
+		find = NEW(Find(string->seg, env->map, &env->flags));
+		if(find==ERROR || env->flags&SPACE) 
 			return 0;
-		kmp->next = rex->next;
-		preg->rex = kmp;
-		string->seg = Seg(0,0);
-		string->next = 0;
-		delete string;
+		find->next = rex->next;
+		preg->rex = find;
 		return ONCE;
 	anchor:
 	case ANCHOR: 
@@ -1127,23 +1198,320 @@ special(regex_t *preg, Cenv *env)
 	return 0;
 }		
 
+/* find the longest literal that every match must contain.
+   a run of literals is accumulated along a sequence; any node
+   that can match more than one string ends it.  Subexp and
+   single Reps are transparent; a Rep with lo>=1 contributes
+   the literal of its first iteration.  off is the distance
+   from the start of the match, -1 once it varies */
+
+struct Lit {
+	enum { MAXLIT = 256, MAXOFF = 1<<20 };
+	uchar run[MAXLIT];	// literal being built
+	int nrun;
+	int runoff;		// its offset
+	uchar best[MAXLIT];	// longest so far
+	int nbest;
+	int bestoff;
+	int off;		// offset of current position
+	Lit(int off) : nrun(0), runoff(off), nbest(0),
+		bestoff(-1), off(off) { }
+	void add(int c, int n) {
+		while(n-- > 0 && nrun < MAXLIT)
+			run[nrun++] = c;
+	}
+	void advance(int n) {
+		off = off<0 || n>MAXOFF || off>MAXOFF? -1: off+n;
+	}
+	void flush() {
+		keep(run, nrun, runoff);
+		nrun = 0;
+		runoff = off;
+	}
+	void keep(uchar *p, int n, int o) {
+		if(n > nbest) {
+			memmove(best, p, n);
+			nbest = n;
+			bestoff = o;
+		}
+	}
+};
+
+static void
+mustlit(Rex *rex, Lit *l)
+{
+	int i, lo, hi;
+	for( ; rex; rex=rex->next) {
+		switch(rex->type) {
+		case OK:
+		case ANCHOR:
+		case END:
+			continue;
+		case STRING:
+		case FIND:
+			for(i=0; i<((String*)rex)->seg.n; i++)
+				l->add(((String*)rex)->seg.p[i], 1);
+			l->advance(((String*)rex)->seg.n);
+			continue;
+		case ONECHAR:
+			lo = ((Dup*)rex)->lo;
+			hi = ((Dup*)rex)->hi;
+			l->add(((Onechar*)rex)->c, lo);
+			if(lo == hi) {
+				l->advance(lo);
+				continue;
+			}
+			l->flush();
+			l->off = -1;
+			l->runoff = -1;		// c{lo,hi}x contains c{lo}x
+			l->add(((Onechar*)rex)->c, lo);
+			continue;
+		case DOT:
+		case CLASS:
+			lo = ((Dup*)rex)->lo;
+			hi = ((Dup*)rex)->hi;
+			l->advance(lo);
+			if(lo != hi)
+				l->off = -1;
+			l->flush();
+			continue;
+		case TRIE:
+			l->advance(((Trie*)rex)->min);
+			if(((Trie*)rex)->min != ((Trie*)rex)->max)
+				l->off = -1;
+			l->flush();
+			continue;
+		case SUBEXP:
+			mustlit(((Subexp*)rex)->rex, l);
+			continue;
+		case REP:
+			lo = ((Dup*)rex)->lo;
+			hi = ((Dup*)rex)->hi;
+			if(lo==1 && hi==1) {
+				mustlit(((Rep*)rex)->rex, l);
+				continue;
+			}
+			l->flush();
+			if(lo >= 1) {
+				Lit sub(l->off);
+				mustlit(((Rep*)rex)->rex, &sub);
+				sub.flush();
+				l->keep(sub.best, sub.nbest, sub.bestoff);
+			}
+			break;
+		default:		// ALT, BACK, CONJ, NEG
+			l->flush();
+			break;
+		}
+		l->off = -1;
+		l->runoff = -1;
+	}
+}
+
+static Must*
+must(regex_t *preg)
+{
+	Rex *rex = preg->rex;
+	if(rex==ERROR || preg->flags&REG_ICASE)
+		return 0;
+	Lit l(0);
+	mustlit(rex, &l);
+	l.flush();
+	if(l.nbest == 0 ||		// Find already looks for it
+	   (rex->type==FIND && l.bestoff==0))
+		return 0;
+	Seg seg = Seg(l.best, l.nbest).copy();
+	if(seg.p == 0)
+		return 0;
+	return new Must(seg, l.bestoff);
+}
+
+/* the bytes that can begin a match of rex, given that map
+   has been applied to literals; return 1 if rex can match
+   the empty string, or if its first bytes are unknown */
+
+static void
+firstchar(Set *set, int c, uchar *map)
+{
+	for(int i=0; i<=UCHAR_MAX; i++)
+		if(map[i] == c)
+			set->insert(i);
+}
+
+static int
+firstset(Rex *rex, Set *set, uchar *map, int flags)
+{
+	int i;
+	for( ; rex; rex=rex->next) {
+		switch(rex->type) {
+		case OK:
+		case ANCHOR:
+		case END:
+			continue;
+		case DOT:
+			for(i=0; i<=UCHAR_MAX; i++)
+				if(i!='\n' || !(flags&REG_NEWLINE))
+					set->insert(i);
+			break;
+		case CLASS:
+			set->orset(&((Class*)rex)->cl);
+			break;
+		case ONECHAR:
+			firstchar(set, ((Onechar*)rex)->c, map);
+			break;
+		case STRING:
+		case FIND:
+			firstchar(set, ((String*)rex)->seg.p[0], map);
+			return 0;
+		case TRIE:
+			for(i=0; i<=UCHAR_MAX; i++)
+				if(((Trie*)rex)->root[map[i]&Trie::MASK])
+					set->insert(i);
+			if(((Trie*)rex)->min == 0)
+				continue;
+			return 0;
+		case SUBEXP:
+			if(firstset(((Subexp*)rex)->rex, set, map, flags))
+				continue;
+			return 0;
+		case ALT:
+			i = firstset(((Alt*)rex)->left, set, map, flags);
+			i |= firstset(((Alt*)rex)->right, set, map, flags);
+			if(i)
+				continue;
+			return 0;
+		case REP:
+			if(firstset(((Rep*)rex)->rex, set, map, flags))
+				continue;
+			break;
+		default:		// BACK, CONJ, NEG
+			return 1;
+		}
+		if(((Dup*)rex)->lo > 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* does every match begin a line, as when the pattern
+   begins with ^ or .* under REG_NEWLINE */
+
+static int
+begline(Rex *rex)
+{
+	while(rex->type == SUBEXP)
+		rex = ((Subexp*)rex)->rex;
+	switch(rex->type) {
+	case ANCHOR:
+		return 1;
+	case DOT:
+		return ((Dot*)rex)->lo==0 && ((Dot*)rex)->hi==RE_DUP_INF;
+	}
+	return 0;
+}
+
+static Start*
+start(regex_t *preg, int min)
+{
+	int i, n = 0;
+	Start *st = new Start;
+	if(st == 0)
+		return 0;
+	st->min = min;
+	st->any = firstset(preg->rex, &st->first, preg->map,
+			preg->flags);
+	st->nl = preg->flags&REG_NEWLINE && begline(preg->rex);
+	st->one = -1;
+	for(i=0; i<=UCHAR_MAX; i++)
+		if(st->first.in(i)) {
+			st->one = i;
+			n++;
+		}
+	if(n != 1)
+		st->one = -1;
+	if(n == UCHAR_MAX+1)
+		st->any = 1;
+	if(st->any && !st->nl && min==0) {
+		delete st;
+		return 0;
+	}
+	return st;
+}
+
+/* the Start of an alternation, made in place of st0 */
+
+static Start*
+startcomb(Start *st0, Start *st1)
+{
+	if(st0==0 || st1==0) {
+		delete st0;
+		delete st1;
+		return 0;
+	}
+	st0->first.orset(&st1->first);
+	st0->any |= st1->any;
+	st0->nl &= st1->nl;
+	if(st0->one != st1->one)
+		st0->one = -1;
+	if(st0->min > st1->min)
+		st0->min = st1->min;
+	delete st1;
+	return st0;
+}
+
+/* a memo point must not depend on the values of
+   subexpressions set before it: backreferences inside
+   the rep may only refer to subexpressions inside it,
+   which are cleared at each iteration, and those after
+   it may only refer to subexpressions after it */
+
+static int
+memopoints(Cenv *env)
+{
+	int i, j, k = 0;
+	if(env->nmback < 0)
+		return 0;
+	for(i=0; i<env->nmrep; i++) {
+		Mrep *m = &env->mrep[i];
+		for(j=0; j<env->nmback; j++) {
+			Mback *b = &env->mback[j];
+			if(b->tick < m->tick0)
+				continue;
+			if(b->n <= (b->tick<m->tick1? m->n0: m->n1))
+				break;
+		}
+		if(j == env->nmback)
+			m->rep->memo = k++;
+	}
+	return k;
+}
+
 int
 regcomp(regex_t *preg, const char *pattern, int cflags)
 {
 	preg->rex = 0;
+	preg->prog = 0;
+	preg->must = 0;
+	preg->start = 0;
 	if(Done::done==0 && (Done::done=new Done)==0)
 		return REG_ESPACE;
+	if((preg->arena = new Arena) == 0)
+		return REG_ESPACE;
 	if(cflags & REG_AUGMENTED)
 		cflags |= REG_EXTENDED;
 	cflags &= CFLAGS|GFLAGS;
-	Cenv env(pattern, cflags);
-	if(env.flags&SPACE)
+	Cenv env(pattern, cflags, preg->arena);
+	if(env.flags&SPACE) {
+		regfree(preg);
 		return REG_ESPACE;
+	}
 
 	preg->rex = regAlt(1, &env);
 	cflags |= special(preg, &env);
-	if(preg->rex == ERROR)
+	if(preg->rex == ERROR) {
+		regfree(preg);
 		return env.flags&SPACE? REG_ESPACE: REG_BADPAT;
+	}
 
 	preg->rex->serialize(1);
 	Stat st = preg->rex->stat(&env);
@@ -1154,17 +1522,27 @@ regcomp(regex_t *preg, const char *pattern, int cflags)
 	cflags |= hard(&st);
 	if(cflags & REG_ANCH)
 		cflags |= ONCE;
-	preg->flags = cflags;
+	preg->flags = cflags | STALE;	// prog is made when needed
 	preg->re_nsub = st.p;
 	preg->map = env.map;
+	preg->nmemo = memopoints(&env);
+	preg->must = must(preg);
+	preg->start = start(preg, st.n);
 	return 0;
 }
 
 void
 regfree(regex_t *preg)
 {
-	delete preg->rex;
+	delete preg->arena;	// and with it rex
+	preg->arena = 0;
 	preg->rex = ERROR;
+	delete preg->prog;
+	preg->prog = 0;
+	delete preg->must;
+	preg->must = 0;
+	delete preg->start;
+	preg->start = 0;
 }
 
 size_t
@@ -1183,6 +1561,9 @@ regerror(int errcode, const regex_t*, char *errbuf, size_t errbuf_size)
 	case REG_ESPACE:
 		s = "out of space";
 		break;
+	case REG_EBUDGET:
+		s = "match took too long";
+		break;
 	case REG_BADPAT:
 	case REG_ECOLLATE:
 	case REG_ECTYPE:
@@ -1206,7 +1587,7 @@ regerror(int errcode, const regex_t*, char *errbuf, size_t errbuf_size)
    replacing first with the combination and freeing second.
    return 1 on success.
    the only combinations handled are building a Trie
-   from String|Kmp|Trie and String|Kmp */
+   from String|Find|Trie and String|Find */
 
 int
 regcomb(regex_t *preg0, regex_t *preg1)
@@ -1215,7 +1596,7 @@ regcomb(regex_t *preg0, regex_t *preg1)
 		printf("regcomb\n");
 	Rex *rex0 = preg0->rex;
 	Rex *rex1 = preg1->rex;
-	Cenv env(preg0->flags);
+	Cenv env(preg0->flags, preg0->arena);
 	if(rex0==ERROR || rex0->next ||
 	   rex1==ERROR || rex1->next)
 		return 0;
@@ -1225,6 +1606,106 @@ regcomb(regex_t *preg0, regex_t *preg1)
 	preg0->rex = g;
 	if((preg0->flags&REG_ANCH) == 0)
 		preg0->flags &= ~ONCE;
-	preg1->rex = ERROR;
+	delete preg0->prog;
+	preg0->prog = 0;
+	preg0->flags |= STALE;
+	delete preg0->must;
+	preg0->must = 0;
+	preg0->start = startcomb(preg0->start, preg1->start);
+	preg1->start = 0;
+	regfree(preg1);
 	return 1;
 }
+
+/* a saved regex_t: an Rhead, then the Trie as Trie::save
+   lays it out, in the byte order and alignment of the
+   machine that saved it */
+
+enum { RMAGIC = 0x52655302 };	// version 2
+
+struct Rhead {
+	int magic;
+	int flags;		// from regcomp, and as ready() left them
+	size_t size;		// bytes in all
+	size_t nsub;
+	uchar icase;		// map is fold, not ident
+	uchar start;		// st is preg->start
+	Start st;
+};
+
+/* only a Trie with nothing after it, as grep -f makes of
+   many words with regcomb, is saved; the rest is cheap to
+   compile again */
+
+size_t
+regsave(const regex_t *preg, void *buf, size_t n)
+{
+	Rhead *h = (Rhead*)buf;
+	size_t head = align8(sizeof(Rhead));
+	if(preg->rex == ERROR)
+		return 0;
+	if(preg->flags & STALE)
+		ready((regex_t*)preg);
+	Trie *trie = (Trie*)preg->rex;
+	if(trie->type!=TRIE || trie->next || trie->mapped)
+		return 0;
+	size_t size = head + trie->save(0, 0);
+	if(buf==0 || n<size)
+		return size;
+	memset(buf, 0, head);	// no stray bytes in the padding
+	h->magic = RMAGIC;
+	h->flags = preg->flags;
+	h->size = size;
+	h->nsub = preg->re_nsub;
+	h->icase = preg->map == fold;
+	h->start = preg->start != 0;
+	if(preg->start)
+		h->st = *preg->start;
+	trie->save((uchar*)buf+head, size-head);
+	return size;
+}
+
+int
+regmap(regex_t *preg, const void *buf, size_t n)
+{
+	Rhead *h = (Rhead*)buf;
+	size_t head = align8(sizeof(Rhead));
+	preg->rex = 0;
+	preg->prog = 0;
+	preg->must = 0;
+	preg->start = 0;
+	preg->arena = 0;
+	if(n<head || (size_t)buf%8 || h->magic!=RMAGIC || h->size>n ||
+	   h->size<head || h->nsub!=0)
+		return REG_BADPAT;
+	if(Done::done==0 && (Done::done=new Done)==0)
+		return REG_ESPACE;
+	if(fold[UCHAR_MAX] == 0)
+		init();
+	if((preg->arena = new Arena) == 0)
+		return REG_ESPACE;
+	Cenv cenv(h->flags, preg->arena), *env = &cenv;
+	Trie *trie = (Trie*)NEW(Trie());
+	if(trie == ERROR) {
+		regfree(preg);
+		return REG_ESPACE;
+	}
+	preg->rex = trie;
+	if(trie->map((uchar*)buf+head, h->size-head)) {
+		regfree(preg);
+		return REG_BADPAT;
+	}
+	preg->flags = h->flags;
+	preg->re_nsub = h->nsub;
+	preg->map = h->icase? fold: ident;
+	preg->nmemo = 0;
+	if(h->start) {
+		if((preg->start = new Start) == 0) {
+			regfree(preg);
+			return REG_ESPACE;
+		}
+		*preg->start = h->st;
+	}
+	preg->prog = mkProg(preg);
+	return 0;
+}
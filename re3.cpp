@@ -0,0 +1,1351 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "re.h"
+
+/* automata for regexec.  mkProg() flattens a Rex tree into
+   a nondeterministic automaton, Prog.  dfaexec() runs it
+   as a deterministic automaton whose states are made only
+   when the text calls for them, so it takes constant time
+   per character and never backtracks.  it can only say
+   whether there is a match, which is all that REG_NOSUB
+   wants.  tagexec() also finds submatches, for patterns
+   that can be parsed in one pass.  see re.h for the
+   instruction set */
+
+/* compilation of a Prog.  emit() returns the number of the
+   first instruction of a pattern whose successor is to be
+   instruction follow, or -1 if the pattern can't be done */
+
+struct Pcomp {
+	Prog *prog;
+	uchar *map;
+	int flags;
+	int charset[UCHAR_MAX+1];	// set of a mapped char, or -1
+	Pcomp(Prog *prog, uchar *map) : prog(prog), map(map),
+		flags(prog->flags) {
+		for(int i=0; i<=UCHAR_MAX; i++) charset[i] = -1; }
+	int inst(int op, int x, int y=-1);
+	int mark(int be, Rex*, int n1, int n2, int x);
+	int newset(Set*);
+	int chr(int c);
+	int dup(Dup*, int s, int follow);
+	int trie(Trie*, int, int follow);
+	int rep(Rep*, int follow);
+	int emit(Rex*, int follow);
+	int emit1(Rex*, int follow);
+	void first();
+	void memopoints();
+};
+
+int Pcomp::inst(int op, int x, int y)
+{
+	int n = prog->ninst;
+	if(x<0 || n>=Prog::MAXINST || prog->inst.assure(n))
+		return -1;
+	Inst &i = prog->inst[n];
+	memset(&i, 0, sizeof(i));
+	i.op = op;
+	i.x = x;
+	i.y = y;
+	return prog->ninst++;
+}
+
+int Pcomp::mark(int be, Rex *rex, int n1, int n2, int x)
+{
+	int n = inst(MARK, x);
+	if(n >= 0) {
+		Inst &i = prog->inst[n];
+		i.be = be;
+		i.serial = rex->serial;
+		i.n1 = n1;
+		i.n2 = n2;
+	}
+	return n;
+}
+
+int Pcomp::newset(Set *s)
+{
+	int n = prog->nset;
+	if(prog->set.assure(n))
+		return -1;
+	prog->set[n] = *s;
+	return prog->nset++;
+}
+
+int Pcomp::chr(int c)		// set of chars that map to c
+{
+	if(charset[c] < 0) {
+		Set s;
+		for(int i=0; i<=UCHAR_MAX; i++)
+			if(map[i] == c)
+				s.insert(i);
+		charset[c] = newset(&s);
+	}
+	return charset[c];
+}
+
+/* the simple closures x{lo,hi} of Dot, Class and Onechar
+   take the longest run first, as Dot::parse does */
+
+int Pcomp::dup(Dup *d, int s, int follow)
+{
+	int k, f = follow;
+	if(s < 0 || d->lo > Prog::MAXINST)
+		return -1;
+	if(d->hi == RE_DUP_INF) {
+		f = inst(SPLIT, follow, follow);
+		k = inst(CHR, f, s);
+		if(k < 0)
+			return -1;
+		prog->inst[f].x = k;
+	} else if(d->hi-d->lo > Prog::MAXINST)
+		return -1;
+	else for(k=d->lo; k<d->hi; k++)
+		f = inst(SPLIT, inst(CHR, f, s), follow);
+	for(k=0; k<d->lo; k++)
+		f = inst(CHR, f, s);
+	return f;
+}
+
+/* a word that ends at a node which has sons is first
+   continued, as Trie::parse does */
+
+int Pcomp::trie(Trie *t, int i, int follow)
+{
+	int f = follow;
+	Trie::Tnode node = t->node[i];
+	if(node.son) {
+		f = trie(t, node.son, follow);
+		if(node.end)
+			f = inst(SPLIT, f, follow);
+	}
+	f = inst(CHR, f, chr(node.c));
+	if(node.sib)
+		f = inst(SPLIT, f, trie(t, node.sib, follow));
+	return f;
+}
+
+/* Rep{lo,hi} is unrolled into lo iterations, then hi-lo
+   optional ones, or a loop if hi is infinite.  the empty
+   check follows Rep1::parse: an optional null iteration
+   is unwanted, except in a hard BRE, where it ends the
+   repetition */
+
+int Pcomp::rep(Rep *r, int follow)
+{
+	int k, f, end;
+	int exit = mark(ENDP, r, 0, 0, follow);
+	int empty = flags&REG_EXTENDED || (flags&HARD)==0? KILL: EXIT;
+	if(r->lo > Prog::MAXINST)
+		return -1;
+	if(r->hi == RE_DUP_INF) {
+		f = inst(SPLIT, exit, exit);
+		end = mark(ENDP, r, 0, 0, f);
+		if(end < 0)
+			return -1;
+		prog->inst[end].empty = empty;
+		prog->inst[end].y = exit;
+		k = mark(BEGI, r, r->n1, r->n2, emit(r->rex, end));
+		if(k < 0)	// inst may have moved
+			return -1;
+		prog->inst[f].x = k;
+	} else if(r->hi-r->lo > Prog::MAXINST)
+		return -1;
+	else for(f=exit, k=r->hi; --k>=r->lo; ) {
+		end = mark(ENDP, r, 0, 0, f);
+		if(end < 0)
+			return -1;
+		prog->inst[end].empty = empty;
+		prog->inst[end].y = exit;
+		f = inst(SPLIT, mark(BEGI, r, r->n1, r->n2,
+				     emit(r->rex, end)), exit);
+	}
+	for(k=0; k<r->lo; k++)
+		f = mark(BEGI, r, r->n1, r->n2,
+			 emit(r->rex, mark(ENDP, r, 0, 0, f)));
+	return mark(BEGR, r, 0, 0, f);
+}
+
+int Pcomp::emit(Rex *rex, int follow)
+{
+	if(rex == 0 || follow < 0)
+		return follow;
+	return emit1(rex, emit(rex->next, follow));
+}
+
+int Pcomp::emit1(Rex *rex, int f)
+{
+	int i, l, r;
+	Set s;
+	if(f < 0)
+		return f;
+	switch(rex->type) {
+	case OK:
+		return f;
+	case ANCHOR:
+		return inst(BOL, f);
+	case END:
+		return inst(EOL, f);
+	case DOT:
+		s.neg();
+		if(flags & REG_NEWLINE)
+			s.cl['\n'/CHAR_BIT] &= ~(1 << ('\n'%CHAR_BIT));
+		return dup((Dup*)rex, newset(&s), f);
+	case CLASS:
+		return dup((Dup*)rex, newset(&((Class*)rex)->cl), f);
+	case ONECHAR:
+		return dup((Dup*)rex, chr(((Onechar*)rex)->c), f);
+	case STRING:
+	case FIND:
+		for(i=((String*)rex)->seg.n; --i>=0; )
+			f = inst(CHR, f, chr(((String*)rex)->seg.p[i]));
+		return f;
+	case TRIE:
+		if(2*((Trie*)rex)->nnode > Prog::MAXINST-prog->ninst ||
+		   ((Trie*)rex)->merged)
+			return -1;
+		for(l=-1, i=0; i<Trie::NROOT; i++) {
+			if(((Trie*)rex)->root[i] == 0)
+				continue;
+			r = trie((Trie*)rex, ((Trie*)rex)->root[i], f);
+			l = l<0? r: inst(SPLIT, l, r);
+			if(l < 0)
+				return -1;
+		}
+		return l;
+	case SUBEXP:
+		i = ((Subexp*)rex)->n;
+		f = emit(((Subexp*)rex)->rex, mark(ENDP, rex, i, i, f));
+		return mark(BEGS, rex, i, i, f);
+	case ALT: {
+		Alt *alt = (Alt*)rex;
+		int n2 = alt->n2>alt->n1? alt->n2: alt->n1;
+		l = mark(ENDP, alt, 0, 0, f);
+		l = mark(BEGA, alt, alt->n1, n2, emit(alt->left, l));
+		r = mark(ENDP, alt, 0, 0, f);
+		if(r >= 0)	// Alt1 has the serial of the right
+			prog->inst[r].serial = alt->rserial;
+		r = mark(BEGA, alt, 0, 0, emit(alt->right, r));
+		if(l<0 || r<0)
+			return -1;
+		prog->inst[r].serial = alt->rserial;
+		return inst(SPLIT, l, r);
+	}
+	case REP:
+		return rep((Rep*)rex, f);
+	}
+	return -1;		// BACK, NEG, CONJ
+}
+
+Prog *mkProg(regex_t *preg)
+{
+	Prog *prog = new Prog(preg->flags);
+	Pcomp c(prog, preg->map);
+	int f = c.inst(MATCH, 0);
+	prog->start = c.emit(preg->rex, f);
+	if(prog->start < 0) {
+		delete prog;
+		return 0;
+	}
+	prog->anchored = (preg->flags&ONCE) && preg->rex->type!=FIND;
+	c.first();
+	c.memopoints();
+	return prog;
+}
+
+/* add the pattern of preg to a Prog for a regset, which
+   runs the union of its patterns at once.  the MATCH of
+   each says which pattern it ends.  returns 1, leaving the
+   Prog as it was, if the pattern can't be done or the Prog
+   would be too big */
+
+int setadd(Prog *prog, regex_t *preg, int id)
+{
+	int ninst = prog->ninst, nset = prog->nset;
+	Pcomp c(prog, preg->map);
+	c.flags = preg->flags;
+	int f = c.inst(MATCH, 0, id);
+	int s = c.emit(preg->rex, f);
+	if(s>=0 && prog->start>=0)
+		s = c.inst(SPLIT, prog->start, s);
+	if(s < 0) {
+		prog->ninst = ninst;
+		prog->nset = nset;
+		return 1;
+	}
+	prog->start = s;
+	prog->nid++;
+	return 0;
+}
+
+/* finish compiling when regnexec is first called, since
+   grep may combine thousands of patterns one by one with
+   regcomb: make the Prog and get a Trie ready.  callers
+   that race wait for the first */
+
+static volatile int readying;
+
+Prog *ready(regex_t *preg)
+{
+	while(__sync_lock_test_and_set(&readying, 1))
+		continue;
+	if(preg->flags & STALE) {
+		if(preg->rex->type == TRIE)
+			((Trie*)preg->rex)->ready(preg->flags&ONCE,
+				preg->map);
+		preg->prog = mkProg(preg);
+		__atomic_store_n(&preg->flags, preg->flags&~STALE,
+			__ATOMIC_RELEASE);
+	}
+	__sync_lock_release(&readying);
+	return preg->prog;
+}
+
+/* the bytes that can begin a match, and whether a match
+   can be empty, taking assertions to be true */
+
+void Pcomp::first()
+{
+	int n = prog->ninst, sp = 0;
+	Array<int> stack;
+	Array<char> seen;
+	if(stack.assure(2*n) || seen.assure(n)) {
+		prog->null = 1;		// i.e. don't know
+		return;
+	}
+	memset(&seen[0], 0, n);
+	stack[sp++] = prog->start;
+	while(sp > 0) {
+		int i = stack[--sp];
+		if(seen[i])
+			continue;
+		seen[i] = 1;
+		Inst *ip = &prog->inst[i];
+		switch(ip->op) {
+		case CHR:
+			prog->first.orset(&prog->set[ip->y]);
+			continue;
+		case MATCH:
+			prog->null = 1;
+			continue;
+		case SPLIT:
+			stack[sp++] = ip->y;
+			break;
+		case MARK:
+			if(ip->empty == EXIT)
+				stack[sp++] = ip->y;
+			break;
+		}
+		stack[sp++] = ip->x;
+	}
+}
+
+/* the memo points of backexec() in re5.cpp: CHRs that a
+   parse might reach along two paths, or from two starts,
+   i.e. all but those reached only from one CHR.  also the
+   number of subpattern serials, for its record of where
+   iterations began */
+
+void Pcomp::memopoints()
+{
+	int i, n = prog->ninst;
+	Array<int> from;	// a CHR led here, 0 if none, -1 if more
+	Inst *ip;
+	prog->nmemo = prog->nserial = 0;
+	if(from.assure(n) || prog->memo.assure(n))
+		return;
+	memset(&from[0], 0, n*sizeof(int));
+	from[prog->start] = -1;
+	for(i=0; i<n; i++) {
+		ip = &prog->inst[i];
+		if(ip->op == MATCH)
+			continue;
+		if(ip->op==SPLIT || (ip->op==MARK && ip->empty==EXIT))
+			from[ip->y] = -1;
+		if(ip->op==MARK && ip->serial>=prog->nserial)
+			prog->nserial = ip->serial + 1;
+		from[ip->x] = ip->op!=CHR || from[ip->x]? -1: i+1;
+	}
+	for(i=0; i<n; i++)
+		prog->memo[i] = prog->inst[i].op==CHR && from[i]<=0?
+			prog->nmemo++: -1;
+}
+
+/* DFA states.  a state is the set of instructions that the
+   automaton is about to execute, before following SPLITs,
+   MARKs and assertions, plus whether ^ would match.  the
+   epsilon closure is taken afresh when a transition
+   is made, because whether $ matches depends on the next
+   character.  transitions are indexed by byte class:
+   bytes that no CHR set, nor $, can tell apart */
+
+struct Dstate {
+	Dstate *link;		// next in hash chain
+	int *k;			// kernel, sorted instruction numbers
+	int nk;
+	uchar bol;		// ^ matches here
+	uchar acc;		// ACC0|ACC1 on completion
+	uchar stop;		// ACC0|ACC1|DEAD (see re.h), tested on every char
+	int *ids;		// regset: patterns that end here,
+	int nid[2];		// nid[0] always, then nid[1] at $
+	unsigned seen[2];	// epoch when ids were last marked
+	Dstate *next[1];	// transitions by byte class
+};
+
+/* states are carved from big blocks.  when MEMORY is
+   used up, all states are thrown away and making them
+   starts over.  at worst a state is made for every char,
+   which is slow, but never exponential */
+
+struct Dfa {
+	enum { NHASH = 1<<12, BLOCK = 1<<16, MEMORY = 1<<22 };
+	Prog *prog;
+	Inst *inst;
+	int nclass;
+	uchar cls[UCHAR_MAX+1];	// byte class of each char
+	Dstate *start[2];	// start states, by bol
+	Dstate *hash[NHASH];
+	char *block;		// chain of allocated blocks
+	char *free, *end;	// unallocated part of block
+	long used;		// memory in states
+	int *sparse, *dense;	// sparse set for closures
+	int ndense;
+	int *stack;
+	int *kbuf;		// kernel under construction
+	unsigned epoch;		// count of setexecs
+	Dfa(Prog*);
+	~Dfa();
+	void reset();
+	void *alloc(size_t);
+	int closure(int*, int, int, int);
+	Dstate *state(int*, int, int);
+	Dstate *step(Dstate*, int, int);
+	Dstate *first(int);
+	Dstate *move(Dstate*, int, int);
+	int exec(uchar*, uchar*, int);
+	int setexec(uchar*, uchar*, int, uchar*);
+	void ids(Dstate*, int);
+	int table(Dtab*, int);
+};
+
+Dfa::Dfa(Prog *prog) : prog(prog), inst(&prog->inst[0]), block(0),
+	free(0), end(0), used(0), epoch(0)
+{
+	int n = prog->ninst;
+	sparse = new int[4*n]();
+	dense = sparse + n;
+	stack = dense + n;
+	kbuf = stack + n;
+	nclass = prog->classes(cls);
+	memset(hash, 0, sizeof(hash));
+	start[0] = start[1] = 0;
+}
+
+Dfa::~Dfa()
+{
+	reset();
+	delete [] sparse;
+}
+
+void Dfa::reset()
+{
+	while(block) {
+		char *b = block;
+		block = *(char**)b;
+		delete [] b;
+	}
+	free = end = 0;
+	used = 0;
+	memset(hash, 0, sizeof(hash));
+	start[0] = start[1] = 0;
+}
+
+void *Dfa::alloc(size_t n)
+{
+	n = (n + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if(free==0 || (size_t)(end-free)<n) {
+		size_t size = n+sizeof(char*) > BLOCK?
+			      n+sizeof(char*): (size_t)BLOCK;
+		char *b = new char[size];
+		*(char**)b = block;
+		block = b;
+		free = b + sizeof(char*);
+		end = b + size;
+		used += size;
+	}
+	void *p = free;
+	free += n;
+	return p;
+}
+
+/* epsilon closure of kernel k into the sparse set dense[].
+   returns ACC0 if MATCH is reached, plus ACC1 if
+   an EOL was passed over (eol=1) or blocked (eol=0) */
+
+int Dfa::closure(int *k, int nk, int bol, int eol)
+{
+	int i, sp = 0, result = 0;
+	ndense = 0;
+	for(i=nk; --i>=0; )
+		stack[sp++] = k[i];
+	while(sp > 0) {
+		i = stack[--sp];
+		if((unsigned)sparse[i] < (unsigned)ndense &&
+		   dense[sparse[i]] == i)
+			continue;
+		sparse[i] = ndense;
+		dense[ndense++] = i;
+		Inst *ip = &inst[i];
+		switch(ip->op) {
+		case MATCH:
+			result |= ACC0;
+			continue;
+		case CHR:
+			continue;
+		case BOL:
+			if(!bol)
+				continue;
+			break;
+		case EOL:
+			result |= ACC1;
+			if(!eol)
+				continue;
+			break;
+		case SPLIT:
+			stack[sp++] = ip->y;
+			break;
+		case MARK:
+			if(ip->empty == EXIT)
+				stack[sp++] = ip->y;
+			break;
+		}
+		stack[sp++] = ip->x;
+	}
+	return result;
+}
+
+static int cmpint(const void *a, const void *b)
+{
+	return *(int*)a - *(int*)b;
+}
+
+/* for a regset, the patterns whose MATCHes are in
+   closure(d, eol), which follows closure(d, 0) */
+
+void Dfa::ids(Dstate *d, int eol)
+{
+	int i, j, n = 0, n0 = d->nid[0];
+	Array<int> id;
+	for(i=0; i<ndense; i++) {
+		Inst *ip = &inst[dense[i]];
+		if(ip->op != MATCH)
+			continue;
+		for(j=0; j<n0 && d->ids[j]!=ip->y; j++)
+			continue;
+		if(j < n0)
+			continue;
+		if(id.assure(n))
+			return;
+		id[n++] = ip->y;
+	}
+	if(n == 0)
+		return;
+	int *p = (int*)alloc((n0+n)*sizeof(int));
+	memmove(p, d->ids, n0*sizeof(int));
+	memmove(p+n0, &id[0], n*sizeof(int));
+	d->ids = p;
+	d->nid[eol] = n;
+}
+
+/* find or make the state with kernel k, which is sorted */
+
+Dstate *Dfa::state(int *k, int nk, int bol)
+{
+	unsigned h = bol;
+	int i;
+	for(i=0; i<nk; i++)
+		h = h*31 + k[i];
+	h &= NHASH-1;
+	Dstate *d;
+	for(d=hash[h]; d; d=d->link)
+		if(d->nk==nk && d->bol==bol &&
+		   memcmp(d->k, k, nk*sizeof(int)) == 0)
+			return d;
+	if(used > MEMORY)
+		return 0;
+	d = (Dstate*)alloc(sizeof(Dstate) +
+			   (nclass-1)*sizeof(Dstate*) + nk*sizeof(int));
+	memset(d->next, 0, nclass*sizeof(Dstate*));
+	d->k = (int*)&d->next[nclass];
+	memmove(d->k, k, nk*sizeof(int));
+	d->nk = nk;
+	d->bol = bol;
+	d->ids = 0;
+	d->nid[0] = d->nid[1] = 0;
+	d->seen[0] = d->seen[1] = 0;
+	int acc = closure(k, nk, bol, 0);
+	if(prog->nid) {			// a regset goes on past matches
+		if(acc & ACC0)
+			ids(d, 0);
+		if(acc&ACC1 && closure(k, nk, bol, 1)&ACC0)
+			ids(d, 1);
+		acc = 0;
+	} else if(acc & ACC0)
+		acc = ACC0;
+	else if(acc & ACC1)
+		acc = closure(k, nk, bol, 1)&ACC0? ACC1: 0;
+	d->acc = acc;
+	d->stop = prog->flags&REG_ANCH? 0: acc;
+	if(nk == 0)
+		d->stop |= DEAD;
+	d->link = hash[h];
+	hash[h] = d;
+	return d;
+}
+
+/* $ before char c; at the end of the subject it is
+   !(flags&REG_NOTEOL) instead, since the subject is as
+   long as it is said to be and the byte past it is not
+   read */
+
+static inline int eol(int c, int flags)
+{
+	return c=='\n' && flags&REG_NEWLINE;
+}
+
+/* the transition from d on char c; 0 if memory ran out */
+
+Dstate *Dfa::step(Dstate *d, int c, int flags)
+{
+	int i, nk = 0;
+	closure(d->k, d->nk, d->bol, eol(c, flags));
+	for(i=0; i<ndense; i++) {
+		Inst *ip = &inst[dense[i]];
+		if(ip->op==CHR && prog->set[ip->y].in(c))
+			kbuf[nk++] = ip->x;
+	}
+	if(!prog->anchored)
+		kbuf[nk++] = prog->start;
+	qsort(kbuf, nk, sizeof(int), cmpint);
+	int n = 0;
+	for(i=0; i<nk; i++)
+		if(n==0 || kbuf[i]!=kbuf[n-1])
+			kbuf[n++] = kbuf[i];
+	Dstate *t = state(kbuf, n, c=='\n' && flags&REG_NEWLINE);
+	if(t)
+		d->next[cls[c]] = t;
+	return t;
+}
+
+/* the start state */
+
+Dstate *Dfa::first(int bol)
+{
+	Dstate *d = start[bol];
+	if(d == 0) {
+		d = state(&prog->start, 1, bol);
+		if(d == 0) {
+			reset();
+			d = state(&prog->start, 1, bol);
+		}
+		start[bol] = d;
+	}
+	return d;
+}
+
+/* the transition from d on c, made if need be.  if memory
+   runs out, all states but d's successor are forgotten */
+
+Dstate *Dfa::move(Dstate *d, int c, int flags)
+{
+	Dstate *t = d->next[cls[c]];
+	if(t == 0) {
+		t = step(d, c, flags);
+		if(t == 0) {
+			int nk = d->nk, b = d->bol;
+			memmove(kbuf, d->k, nk*sizeof(int));
+			reset();
+			d = state(kbuf, nk, b);
+			t = step(d, c, flags);
+		}
+	}
+	return t;
+}
+
+int Dfa::exec(uchar *s, uchar *last, int flags)
+{
+	Dstate *d = first(!(flags & REG_NOTBOL));
+	for( ; s<last; s++) {
+		if(d->stop) {
+			if(d->stop & DEAD)
+				return 0;
+			if(d->stop&ACC0 || eol(*s, flags))
+				return 1;
+		}
+		Dstate *t = d->next[cls[*s]];
+		d = t? t: move(d, *s, flags);
+	}
+	return d->acc&ACC0 || (d->acc&ACC1 && !(flags&REG_NOTEOL));
+}
+
+/* exec for a regset: set which[id] for the patterns of
+   the Prog that match in s, stopping when all have.  if
+   which is 0, stop at the first.  returns 1 if any match */
+
+int Dfa::setexec(uchar *s, uchar *last, int flags, uchar *which)
+{
+	int i, j, left = prog->nid, any = 0;
+	int anch = prog->flags & REG_ANCH;
+	if(++epoch == 0) {		// marks of long ago look new
+		reset();
+		epoch = 1;
+	}
+	Dstate *d = first(!(flags & REG_NOTBOL));
+	for(;; s++) {
+		if(d->ids && (!anch || s>=last)) {
+			int e = d->nid[1] && (s<last? eol(*s, flags):
+				!(flags&REG_NOTEOL));
+			if(which == 0 && (d->nid[0] || e))
+				return 1;
+			for(j=0; j<=e; j++) {
+				if(d->seen[j] == epoch)
+					continue;
+				d->seen[j] = epoch;
+				int *id = d->ids + (j? d->nid[0]: 0);
+				for(i=0; i<d->nid[j]; i++)
+					if(!which[id[i]]) {
+						which[id[i]] = 1;
+						left--;
+						any = 1;
+					}
+			}
+			if(left == 0)
+				return 1;
+		}
+		if(s>=last || d->stop&DEAD)
+			return any;
+		d = move(d, *s, flags);
+	}
+}
+
+/* make every state reachable from the starts, under the
+   given REG_NOTEOL, into tab.  returns 1 if they are too
+   many or memory runs out */
+
+int Dfa::table(Dtab *tab, int flags)
+{
+	enum { MAXSTATE = 1<<10, NH = 2*MAXSTATE };
+	Array<Dstate*> states;
+	Dstate *h[NH];		// states, hashed by address
+	int ix[NH];		// and their numbers
+	uchar rep[UCHAR_MAX+1];	// a byte of each class
+	int i, k, c, n = 0;
+	memset(h, 0, sizeof(h));
+	for(c=UCHAR_MAX; c>=0; c--)
+		rep[cls[c]] = c;
+	for(k=-2; k<n*nclass; k++) {	// the starts, then all moves
+		Dstate *d = k<0? state(&prog->start, 1, k+2):
+			step(states[k/nclass], rep[k%nclass], flags);
+		if(d == 0)
+			return 1;
+		for(i=((size_t)d>>4)%NH; h[i] && h[i]!=d; i=(i+1)%NH)
+			continue;
+		if(h[i] == 0) {
+			if(n>=MAXSTATE || states.assure(n) ||
+			   tab->stop.assure(n) || tab->acc.assure(n))
+				return 1;
+			h[i] = d;
+			ix[i] = n;
+			states[n] = d;
+			tab->stop[n] = d->stop;
+			tab->acc[n] = d->acc;
+			n++;
+		}
+		if(k < 0)
+			tab->start[k+2] = ix[i];
+		else if(tab->next.assure(k))
+			return 1;
+		else
+			tab->next[k] = ix[i];
+	}
+	tab->nstate = n;
+	tab->nclass = nclass;
+	memmove(tab->cls, cls, sizeof(cls));
+	tab->flags = flags & (REG_NEWLINE|REG_NOTEOL);
+	return 0;
+}
+
+/* sort bytes into classes that no CHR set, nor $, can tell
+   apart.  returns the number of classes */
+
+int Prog::classes(uchar *cls)
+{
+	int i, c, j, n = 1;
+	int key[2*(UCHAR_MAX+1)];
+	uchar nc[UCHAR_MAX+1];
+	memset(cls, 0, UCHAR_MAX+1);
+	for(i=-1; i<nset; i++) {	// refine classes by each set
+		Set nl;
+		if(i == -1)		// $ sees this
+			nl.insert('\n');
+		Set *s = i<0? &nl: &set[i];
+		for(j=0; j<2*n; j++)
+			key[j] = -1;
+		for(j=0, c=0; c<=UCHAR_MAX; c++) {
+			int k = 2*cls[c] + s->in(c);
+			if(key[k] < 0)
+				key[k] = j++;
+			nc[c] = key[k];
+		}
+		memmove(cls, nc, UCHAR_MAX+1);
+		n = j;
+	}
+	return n;
+}
+
+/* returns 1 if string s matches, 0 if not, or -1 if the
+   automaton is busy in another thread.  flags are from
+   regcomp and regexec.  under REG_JIT the automaton is
+   made whole and compiled, when first wanted for each
+   REG_NOTEOL; if it can't be, the states are made as
+   needed, as usual */
+
+int Prog::dfaexec(uchar *s, uchar *last, int flags)
+{
+	int result, v = (flags&REG_NOTEOL) != 0;
+	if(__sync_lock_test_and_set(&busy, 1))
+		return -1;
+	if(dfa == 0)
+		dfa = new Dfa(this);
+	if(flags&REG_JIT && jit[v]==0 && !nojit[v]) {
+		Dtab tab;
+		if(dfa->table(&tab, flags) == 0)
+			jit[v] = ::jit(&tab);
+		nojit[v] = jit[v] == 0;
+	}
+	if(jit[v])
+		result = jitexec(jit[v], s, last, !(flags&REG_NOTBOL));
+	else
+		result = dfa->exec(s, last, flags);
+	__sync_lock_release(&busy);
+	return result;
+}
+
+/* dfaexec for a regset: sets which[id] for each pattern
+   of the Prog that matches s, or if which is 0 finds
+   whether any does.  returns 1 if any does, 0 if none, or
+   -1 if the automaton is busy in another thread */
+
+int Prog::setexec(uchar *s, uchar *last, int flags, uchar *which)
+{
+	int result;
+	if(__sync_lock_test_and_set(&busy, 1))
+		return -1;
+	if(dfa == 0)
+		dfa = new Dfa(this);
+	result = dfa->setexec(s, last, flags, which);
+	__sync_lock_release(&busy);
+	return result;
+}
+
+/* a subject given a piece at a time runs through an
+   automaton of its own, so that its state can be kept from
+   piece to piece and no other thread will reset it */
+
+struct Stream {
+	Dfa *dfa;
+	Dstate *d;		// where the bytes so far have led
+	int flags;		// from regcomp and regstreamopen
+	regoff_t off;		// offset of the next byte
+	int prev;		// the byte before it, or -1
+	int fresh;		// a match ended here; no null one
+};
+
+regstream_t *regstreamopen(const regex_t *preg, int eflags)
+{
+	Prog *prog = preg->prog;
+	if(__atomic_load_n(&preg->flags, __ATOMIC_ACQUIRE) & STALE)
+		prog = ready((regex_t*)preg);
+	if(prog == 0)
+		return 0;
+	Stream *st = new Stream;
+	st->dfa = new Dfa(prog);
+	st->flags = preg->flags | (eflags&EFLAGS);
+	st->d = st->dfa->first(!(eflags & REG_NOTBOL));
+	st->off = 0;
+	st->prev = -1;
+	st->fresh = 0;
+	return st;
+}
+
+int regstreamexec(regstream_t *st, const char *buf, size_t n,
+	size_t *used, regoff_t *end)
+{
+	Dfa *dfa = st->dfa;
+	Dstate *d = st->d;
+	uchar *s = (uchar*)buf, *last = s + n;
+	int flags = st->flags, found = 0;
+	for( ; ; s++) {
+		if(d->stop && !st->fresh) {
+			if(d->stop & DEAD) {
+				s = last;	// no match from here on
+				break;
+			}
+			if(d->stop&ACC0 || (s<last && eol(*s, flags))) {
+				found = 1;
+				break;
+			}
+		}
+		if(s >= last)
+			break;
+		Dstate *t = d->next[dfa->cls[*s]];
+		d = t? t: dfa->move(d, *s, flags);
+		st->fresh = 0;
+	}
+	*used = s - (uchar*)buf;
+	st->off += *used;
+	if(s > (uchar*)buf)
+		st->prev = s[-1];
+	if(!found) {
+		st->d = d;
+		return REG_NOMATCH;
+	}
+	*end = st->off;			// start again after the match
+	st->d = dfa->first(st->prev<0? !(flags&REG_NOTBOL):
+		st->prev=='\n' && flags&REG_NEWLINE);
+	st->fresh = 1;
+	return 0;
+}
+
+int regstreamend(regstream_t *st, regoff_t *end)
+{
+	Dstate *d = st->d;
+	if(st->fresh || !(d->acc&ACC0 || (d->acc&ACC1 &&
+	   !(st->flags&REG_NOTEOL))))
+		return REG_NOMATCH;
+	*end = st->off;
+	return 0;
+}
+
+void regstreamclose(regstream_t *st)
+{
+	if(st) {
+		delete st->dfa;
+		delete st;
+	}
+}
+
+/* what a MARK does to the match array, executed at p,
+   as the recursive matcher would have done it */
+
+void Inst::setmatch(int p, size_t nmatch, regmatch_t *match)
+{
+	int n;
+	if(n1 == 0)
+		return;
+	switch(be) {
+	case BEGS:
+		if((size_t)n1 < nmatch)
+			match[n1].rm_so = p;
+		break;
+	case ENDP:
+		if((size_t)n1 < nmatch)
+			match[n1].rm_eo = p;
+		break;
+	default:		// Save::Save
+		n = n1;
+		do if((size_t)n < nmatch)
+			match[n].rm_so = match[n].rm_eo = -1;
+		while(++n <= n2);
+	}
+}
+
+/* a tagged deterministic automaton, for patterns that can
+   be parsed in one pass.  if, from each instruction a CHR
+   leads to, only one path through SPLITs, MARKs and
+   assertions reaches each instruction, and only one CHR
+   can take any byte, then a string has at most one parse
+   from a given start.  the Pike machine would then have a
+   single thread, and the MARKs it passes between two chars
+   would depend only on where it was and the next char.  so
+   they are found once, as actions on the transitions of a
+   deterministic automaton, and submatches are set while the
+   text is read, with no histories to compare.  a state is
+   the instruction a CHR led to, plus whether ^ matches.
+   tdfa is made whole when first wanted; if the pattern is
+   ambiguous or too big, ok is 0 and the Pike machine or
+   the recursive matcher is used instead */
+
+struct Tedge {
+	int next;		// state after the char, or -1
+	int act;		// MARKs passed on the way, in act[]
+	int match;		// MARKs passed to MATCH, or -1
+};
+
+struct Tend {			// where a walk stopped
+	int pc;			// CHR or MATCH
+	int act;
+};
+
+struct Tdfa {
+	enum { MAXINST = 1<<12, MAXEDGE = 1<<16 };
+	int ok;			// pattern is one-pass
+	Prog *prog;
+	Inst *inst;
+	int nclass;
+	int ncol;		// nclass, plus the end, then the end
+				// under REG_NOTEOL
+	uchar col[UCHAR_MAX+1];	// column of a byte
+	int start[2];		// start states, by bol
+	Array<Tedge> edge;	// ncol per state
+	Array<int> act;		// lists of MARK pcs, each ended by -1
+	int nact;
+		// used while making the automaton
+	int nstate;
+	Array<int> id;		// state of pc and bol, or -1
+	Array<int> kernel;	// 2*pc + bol of each state
+	Array<int> seen;	// stamp of the walk that reached pc
+	int stamp;
+	Array<char> open;	// BEGI passed in this walk, by serial
+	Array<int> path;	// MARKs passed in this walk
+	Array<Tend> end[2];	// results of walks, by eol
+	int nend[2];
+	int eolseen;		// walk met a $
+	Tdfa(Prog*);
+	int state(int pc, int bol);
+	int walk(int pc, int bol, int eol, int np, Array<Tend>&, int&);
+	int fill(int);
+	void apply(int a, int p, size_t nmatch, regmatch_t *match) {
+		for(int *pc=&act[a]; *pc>=0; pc++)
+			inst[*pc].setmatch(p, nmatch, match); }
+	int canstart(uchar *s, int p, int len) {
+		return prog->null || (p<len && prog->first.in(s[p])); }
+	int column(uchar *s, int p, int len, int flags) {
+		return p<len? col[s[p]]: nclass + ((flags&REG_NOTEOL)!=0); }
+	int run(uchar*, int, int, int, size_t, regmatch_t*,
+		regmatch_t*, long&);
+	int runall(uchar*, int, int, int, size_t, regmatch_t*,
+		   Array<int>&, Array<regmatch_t>&);
+	int exec(uchar*, int, int, size_t, regmatch_t*,
+		 Array<int>&, Array<regmatch_t>&);
+};
+
+Tdfa::Tdfa(Prog *prog) : ok(0), prog(prog), inst(&prog->inst[0]),
+	nact(1), nstate(0), stamp(0)
+{
+	int i, n = prog->ninst, nserial = 0;
+	if(n > MAXINST || id.assure(2*n) || seen.assure(n))
+		return;
+	for(i=0; i<n; i++)
+		if(inst[i].op==MARK && inst[i].serial>=nserial)
+			nserial = inst[i].serial + 1;
+	if(open.assure(nserial))
+		return;
+	memset(&open[0], 0, nserial);
+	memset(&seen[0], 0, n*sizeof(int));
+	for(i=0; i<2*n; i++)
+		id[i] = -1;
+	nclass = prog->classes(col);
+	ncol = nclass + 2;
+	act[0] = -1;		// the empty list
+	start[0] = state(prog->start, 0);
+	start[1] = state(prog->start, 1);
+	if(start[0] < 0 || start[1] < 0)
+		return;
+	for(i=0; i<nstate; i++)
+		if(!fill(i))
+			return;
+	ok = 1;
+}
+
+int Tdfa::state(int pc, int bol)
+{
+	int k = 2*pc + bol;
+	if(id[k] >= 0)
+		return id[k];
+	if((nstate+1)*ncol > MAXEDGE || kernel.assure(nstate))
+		return -1;
+	kernel[nstate] = k;
+	return id[k] = nstate++;
+}
+
+/* follow the instructions from pc that don't consume
+   chars, as Pike::closure does, noting in e the CHRs and
+   MATCH reached and the MARKs passed to get there.
+   returns 0 if an instruction is reached twice */
+
+int Tdfa::walk(int pc, int bol, int eol, int np, Array<Tend> &e, int &ne)
+{
+	int r, s, o, empty = 0;
+	Inst *ip = &inst[pc];
+	if(seen[pc] == stamp)
+		return 0;
+	seen[pc] = stamp;
+	switch(ip->op) {
+	case CHR:
+	case MATCH:
+		if(e.assure(ne) || act.assure(nact+np))
+			return 0;
+		e[ne].pc = pc;
+		e[ne].act = 0;
+		if(np > 0) {
+			e[ne].act = nact;
+			memmove(&act[nact], &path[0], np*sizeof(int));
+			nact += np;
+			act[nact++] = -1;
+		}
+		ne++;
+		return 1;
+	case BOL:
+		return !bol || walk(ip->x, bol, eol, np, e, ne);
+	case EOL:
+		eolseen = 1;
+		return !eol || walk(ip->x, bol, eol, np, e, ne);
+	case SPLIT:
+		return walk(ip->x, bol, eol, np, e, ne) &&
+		       walk(ip->y, bol, eol, np, e, ne);
+	}
+	s = ip->serial;		// MARK
+	o = open[s];
+	if(ip->be == BEGI)
+		open[s] = 1;
+	else if(ip->empty != NOCHECK) {
+		empty = o;	// the iteration began in this walk
+		open[s] = 0;
+	}
+	if(ip->n1) {
+		if(path.assure(np))
+			return 0;
+		path[np++] = pc;
+	}
+	if(!empty)
+		r = walk(ip->x, bol, eol, np, e, ne);
+	else if(ip->empty == EXIT)
+		r = walk(ip->y, bol, eol, np, e, ne);
+	else
+		r = 1;
+	open[s] = o;
+	return r;
+}
+
+/* make the transitions of state i, one for each byte class.
+   the walk depends on whether $ matches before the char */
+
+int Tdfa::fill(int i)
+{
+	int pc = kernel[i]>>1, bol = kernel[i]&1;
+	int c, k, j;
+	uchar rep[UCHAR_MAX+3];		// a byte of each column
+	eolseen = 0;
+	nend[0] = nend[1] = 0;
+	stamp++;
+	if(!walk(pc, bol, 0, 0, end[0], nend[0]))
+		return 0;
+	if(eolseen) {
+		stamp++;
+		if(!walk(pc, bol, 1, 0, end[1], nend[1]))
+			return 0;
+	}
+	if(edge.assure((i+1)*ncol))
+		return 0;
+	for(c=UCHAR_MAX; c>=0; c--)
+		rep[col[c]] = c;
+	rep[nclass] = rep[nclass+1] = 0;	// the ends read nothing
+	for(k=0; k<ncol; k++) {
+		c = rep[k];
+		int nl = k<nclass && c=='\n' && prog->flags&REG_NEWLINE;
+		int e = eolseen && (nl || k==nclass);
+		Tedge &t = edge[i*ncol + k];
+		t.next = -1;
+		t.act = 0;
+		t.match = -1;
+		for(j=0; j<nend[e]; j++) {
+			Tend *x = &end[e][j];
+			Inst *ip = &inst[x->pc];
+			if(ip->op == MATCH)
+				t.match = x->act;
+			else if(k<nclass && prog->set[ip->y].in(c)) {
+				if(t.next >= 0)
+					return 0;
+				t.next = state(ip->x, nl);
+				if(t.next < 0)
+					return 0;
+				t.act = x->act;
+			}
+		}
+	}
+	return 1;
+}
+
+/* the parse from p0, if any, as Pike::exec would find it if
+   given no other start.  the registers are in reg.  steps
+   counts the chars read */
+
+int Tdfa::run(uchar *s, int p0, int len, int flags, size_t nmatch,
+	      regmatch_t *match, regmatch_t *reg, long &steps)
+{
+	int p, found = 0, q;
+	size_t k;
+	int bol = (!(flags&REG_NOTBOL) && p0==0) ||
+		  (flags&REG_NEWLINE && p0>0 && s[p0-1]=='\n');
+	q = start[bol];
+	for(k=1; k<nmatch; k++)
+		reg[k].rm_so = reg[k].rm_eo = -1;
+	for(p=p0; ; p++) {
+		Tedge *e = &edge[q*ncol + column(s, p, len, flags)];
+		if(e->match>=0 && (!(flags&REG_ANCH) || p==len)) {
+			memmove(&match[1], &reg[1],
+				(nmatch-1)*sizeof(regmatch_t));
+			apply(e->match, p, nmatch, match);
+			match[0].rm_so = p0;
+			match[0].rm_eo = p;
+			found = 1;
+		}
+		if(p>=len || e->next<0)
+			break;
+		apply(e->act, p, nmatch, reg);
+		q = e->next;
+	}
+	steps += p - p0 + 1;
+	return found;
+}
+
+/* like Pike::exec, from p on: parses from all starts advance
+   together, and when two reach one state, the one that
+   began later is dropped.  but a parse never splits, so
+   there are at most nstate of them, each with its own
+   registers, and no histories.  t holds the stamps and
+   the thread lists, reg the registers */
+
+int Tdfa::runall(uchar *s, int p, int len, int flags, size_t nmatch,
+		 regmatch_t *match, Array<int> &t, Array<regmatch_t> &reg)
+{
+	int i, q, r, nc = 0, nn, nfree, bestso = -1;
+	size_t k;
+	if(t.assure(8*nstate) || reg.assure(nstate*nmatch))
+		return REG_ESPACE;
+	int *stamp = &t[0];		// position+1 where a state is held
+	int *clist = stamp + nstate;	// state, start, registers
+	int *nlist = clist + 3*nstate;
+	int *freeregs = nlist + 3*nstate;
+	memset(stamp, 0, nstate*sizeof(int));
+	for(nfree=0; nfree<nstate; nfree++)
+		freeregs[nfree] = nfree*nmatch;
+	for( ; ; p++) {
+		if(nc == 0) {
+			if(bestso>=0 || (p>0 && prog->anchored))
+				break;
+			while(p<len && !canstart(s, p, len))
+				p++;
+			if(!canstart(s, p, len))
+				break;
+		}
+		if(bestso<0 && (p==0 || !prog->anchored) &&
+		   canstart(s, p, len)) {
+			int bol = (!(flags&REG_NOTBOL) && p==0) ||
+				  (flags&REG_NEWLINE && p>0 && s[p-1]=='\n');
+			q = start[bol];
+			if(stamp[q] != p+1) {
+				stamp[q] = p + 1;
+				r = freeregs[--nfree];
+				for(k=1; k<nmatch; k++)
+					reg[r+k].rm_so = reg[r+k].rm_eo = -1;
+				clist[3*nc] = q;
+				clist[3*nc+1] = p;
+				clist[3*nc+2] = r;
+				nc++;
+			}
+		}
+		for(i=nn=0; i<nc; i++) {
+			int start = clist[3*i+1];
+			r = clist[3*i+2];
+			Tedge *e = &edge[clist[3*i]*ncol +
+					 column(s, p, len, flags)];
+			if(e->match>=0 && (!(flags&REG_ANCH) || p==len) &&
+			   (bestso<0 || start<=bestso)) {
+				memmove(&match[1], &reg[r+1],
+					(nmatch-1)*sizeof(regmatch_t));
+				apply(e->match, p, nmatch, match);
+				match[0].rm_so = bestso = start;
+				match[0].rm_eo = p;
+			}
+			q = e->next;
+			if(p>=len || q<0 || stamp[q]==p+2 ||
+			   (bestso>=0 && start>bestso)) {
+				freeregs[nfree++] = r;
+				continue;
+			}
+			stamp[q] = p + 2;
+			apply(e->act, p, nmatch, &reg[r]);
+			nlist[3*nn] = q;
+			nlist[3*nn+1] = start;
+			nlist[3*nn+2] = r;
+			nn++;
+		}
+		int *l = clist;
+		clist = nlist;
+		nlist = l;
+		nc = nn;
+		if(p >= len)
+			break;
+	}
+	return bestso<0? REG_NOMATCH: 0;
+}
+
+/* the leftmost start with a match wins, and from there the
+   longest match.  trying one start at a time is quickest
+   when the first few starts decide it, but when many go
+   far before failing, the time would be quadratic, so
+   after a few passes over the string the rest are tried
+   together */
+
+int Tdfa::exec(uchar *s, int len, int flags, size_t nmatch,
+	       regmatch_t *match, Array<int> &t, Array<regmatch_t> &reg)
+{
+	int p0;
+	long steps = 0;
+	if(reg.assure(nmatch))
+		return REG_ESPACE;
+	for(p0=0; p0<=(prog->anchored? 0: len); p0++) {
+		if(!canstart(s, p0, len))
+			continue;
+		if(steps > 4L*len + 64)
+			return runall(s, p0, len, flags, nmatch,
+				      match, t, reg);
+		if(run(s, p0, len, flags, nmatch, match, &reg[0], steps))
+			return 0;
+	}
+	return REG_NOMATCH;
+}
+
+/* returns 0, REG_NOMATCH or REG_ESPACE, like regexec, or
+   -1 if the pattern is not one-pass, or the automaton is
+   being made in another thread */
+
+int Prog::tagexec(uchar *s, size_t len, size_t nmatch,
+		  regmatch_t *match, int eflags, Ctx *ctx)
+{
+	Tdfa *t = __atomic_load_n(&tdfa, __ATOMIC_ACQUIRE);
+	if(t == 0) {
+		if(__sync_lock_test_and_set(&tbusy, 1))
+			return -1;
+		if((t = tdfa) == 0) {
+			t = new Tdfa(this);
+			__atomic_store_n(&tdfa, t, __ATOMIC_RELEASE);
+		}
+		__sync_lock_release(&tbusy);
+	}
+	if(t==0 || !t->ok || nmatch==0)
+		return -1;
+	return t->exec(s, len, flags|eflags, nmatch, match,
+		       ctx->tdfa, ctx->match);
+}
+
+Prog::~Prog()
+{
+	delete dfa;
+	delete tdfa;
+	jitfree(jit[0]);
+	jitfree(jit[1]);
+}
@@ -0,0 +1,516 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "re.h"
+
+/* simulation of a Prog by the method of Thompson and Pike.
+   all the parses of a pattern advance through the string
+   together, one char at a time, so time is bounded by the
+   product of pattern and string lengths.  when two parses
+   arrive at the same instruction at the same place, they
+   have the same future, so the one that better() in re1.cpp
+   would have rejected is dropped.
+
+   to make that decision, each parse keeps a history of the
+   records that the recursive matcher would have pushed on
+   its pos array.  histories are trees, shared by the parses
+   that split from a common one.  the comparison looks only
+   at the parts of two histories after they split, and at
+   the subpatterns that were open there.  subpatterns still
+   open at the point of comparison end together in the
+   common future */
+
+struct Hist {
+	Hist *parent;		// previous record
+	Hist *open;		// innermost open subpattern, or 0
+	int ref;		// reference count
+	int depth;		// length of history
+	int pc;			// the MARK instruction
+	int p;			// where it was executed
+};
+
+struct Rec {			// a history record, for comparison
+	short serial;
+	uchar be;
+	int p;
+	void set(Inst *ip, int q) { serial = ip->serial; be = ip->be; p = q; }
+};
+
+struct Thread {
+	int pc;			// a CHR, or -1 if superseded
+	int start;		// where the parse began
+	Hist *h;
+};
+
+struct Pike {
+	enum { BLOCK = 100 };
+	Prog *prog;
+	Inst *inst;
+	uchar *s;		// the string
+	int len;
+	int flags;
+	int step;		// serial number of closure
+	int *stamp;		// step when pc was last reached
+	int *vstart;		// ...by a parse that began here
+	Hist **vh;		// ...with this history
+	int *slot;		// index of CHR pc in nlist
+	int *visited;		// pcs reached in this step
+	int nvisited;
+	Array<Thread> list[2];	// CHRs to try at this char and next
+	Array<Thread> *clist, *nlist;
+	int nc, nn;
+	Array<Thread> stack;	// for closure
+	int sp;
+	Hist *freelist;
+	Hist **blocks;		// for freeing
+	int nblocks;
+	Array<Rec> orec, nrec;	// for comparison
+	Hist *besth;		// history of best match
+	int bestso, besteo;
+	int space;		// out of memory
+	int size;		// instructions stamp is made for
+	Pike();
+	~Pike();
+	void reset(Prog*, uchar*, int, int);
+	void recycle();
+	Hist *mark(Hist*, int pc, int p);
+	void release(Hist*);
+	int flatten(Hist*, Hist*, Array<Rec>&);
+	int better(Hist*, int, Hist*, int);
+	void done(Hist*, int start, int p);
+	void push(Array<Thread>&, int&, int pc, int start, Hist*);
+	void closure(int pc, Hist*, int start, int p);
+	int canstart(int p) {
+		return prog->null || (p<len && prog->first.in(s[p])); }
+	int exec();
+	void replay(size_t nmatch, regmatch_t *match);
+};
+
+/* a Pike lasts in a Ctx from one match to the next, keeping
+   its arrays and histories.  reset() readies it for a match,
+   or sets space */
+
+Pike::Pike() : stamp(0), vh(0), freelist(0), blocks(0), nblocks(0),
+	space(0), size(0)
+{
+}
+
+void Pike::reset(Prog *p, uchar *str, int n, int f)
+{
+	int m = p->ninst;
+	if(m > size) {
+		delete [] stamp;
+		delete [] vh;
+		stamp = new int[5*m];
+		vh = new Hist*[m];
+		size = stamp && vh? m: 0;
+	}
+	if(space)
+		recycle();
+	prog = p;
+	inst = &prog->inst[0];
+	s = str;
+	len = n;
+	flags = f;
+	step = nvisited = nc = nn = 0;
+	besth = 0;
+	bestso = besteo = -1;
+	space = size < m;
+	if(space)
+		return;
+	vstart = stamp + m;
+	slot = vstart + m;
+	visited = slot + m;
+	clist = &list[0];
+	nlist = &list[1];
+	memset(stamp, 0, m*sizeof(int));
+}
+
+/* put every history back on freelist, after running
+   out of space left some unreleased */
+
+void Pike::recycle()
+{
+	freelist = 0;
+	for(int b=0; b<nblocks; b++)
+		for(int i=0; i<BLOCK; i++) {
+			blocks[b][i].parent = freelist;
+			freelist = &blocks[b][i];
+		}
+}
+
+Ctx::~Ctx()
+{
+	delete pike;
+}
+
+Pike::~Pike()
+{
+	while(--nblocks >= 0)
+		delete [] blocks[nblocks];
+	free(blocks);
+	delete [] stamp;
+	delete [] vh;
+}
+
+/* histories are carved from blocks, and recycled
+   through freelist when their reference counts
+   drop to zero */
+
+Hist *Pike::mark(Hist *h, int pc, int p)
+{
+	Hist *n = freelist;
+	if(n == 0) {
+		Hist **b = (Hist**)realloc(blocks,
+			(nblocks+1)*sizeof(Hist*));
+		if(b == 0 || (n = new Hist[BLOCK]) == 0) {
+			if(b)
+				blocks = b;
+			space = 1;
+			return 0;
+		}
+		blocks = b;
+		blocks[nblocks++] = n;
+		for(int i=1; i<BLOCK; i++)
+			n[i-1].parent = &n[i];
+		n[BLOCK-1].parent = 0;
+	}
+	freelist = n->parent;
+	n->parent = h;
+	n->ref = 1;
+	n->depth = h? h->depth+1: 1;
+	n->pc = pc;
+	n->p = p;
+	if(inst[pc].be != ENDP)
+		n->open = n;
+	else {
+		Hist *b = h->open;	// what this closes
+		n->open = b->parent? b->parent->open: 0;
+	}
+	if(h)
+		h->ref++;
+	return n;
+}
+
+void Pike::release(Hist *h)
+{
+	while(h && --h->ref == 0) {
+		Hist *parent = h->parent;
+		h->parent = freelist;
+		freelist = h;
+		h = parent;
+	}
+}
+
+/* records of history h since ancestor a, preceded by the
+   beginnings of the subpatterns that were open at a */
+
+int Pike::flatten(Hist *h, Hist *a, Array<Rec> &rec)
+{
+	int i, n = 0;
+	Hist *o;
+	for(o=a? a->open: 0; o; o=o->parent? o->parent->open: 0)
+		n++;
+	int m = n + (h? h->depth: 0) - (a? a->depth: 0);
+	if(rec.assure(m)) {
+		space = 1;
+		return 0;
+	}
+	for(i=n, o=a? a->open: 0; o; o=o->parent? o->parent->open: 0)
+		rec[--i].set(&inst[o->pc], o->p);
+	for(i=m; h!=a; h=h->parent)
+		rec[--i].set(&inst[h->pc], h->p);
+	return m;
+}
+
+static Rec *rpos(Rec *a, Rec *end)	// matching end, or end if open
+{
+	int serial = a->serial;
+	int inner;
+	for(inner=0; ++a<end; ) {
+		if(a->serial != serial)
+			continue;
+		if(a->be != ENDP)
+			inner++;
+		else if(inner-- <= 0)
+			break;
+	}
+	return a;
+}
+
+/* better() of re1.cpp, where subpatterns that are still
+   open end after all closed ones.  the cases that would
+   be impossible there are decided by symmetry */
+
+static int better(Rec *os, Rec *ns, Rec *oend, Rec *nend)
+{
+	Rec *oe, *ne;
+	int k;
+	for( ; os<oend && ns<nend; os=oe+1, ns=ne+1) {
+		if(ns->serial > os->serial)
+			return -1;
+		if(os->serial > ns->serial)
+			return 1;
+		if(os->p > ns->p)
+			return -1;
+		if(ns->p > os->p)
+			return 1;
+		oe = rpos(os, oend);
+		ne = rpos(ns, nend);
+		int op = oe<oend? oe->p: INT_MAX;
+		int np = ne<nend? ne->p: INT_MAX;
+		if(np > op)
+			return 1;
+		if(op > np)
+			return -1;
+		k = better(os+1, ns+1, oe, ne);
+		if(k)
+			return k;
+	}
+	if(ns < nend)
+		return -1;
+	return os < oend;
+}
+
+/* is the parse (nh, ns) better than (oh, os), both having
+   reached the same pc at the same place?  ties go to the
+   old one, which was found first */
+
+int Pike::better(Hist *oh, int os, Hist *nh, int ns)
+{
+	if(os != ns)
+		return ns < os;
+	Hist *a = oh, *b = nh;		// find common ancestor
+	int da = a? a->depth: 0;
+	int db = b? b->depth: 0;
+	for( ; da>db; da--)
+		a = a->parent;
+	for( ; db>da; db--)
+		b = b->parent;
+	while(a != b)
+		a = a->parent, b = b->parent;
+	int m = flatten(oh, a, orec);
+	int n = flatten(nh, a, nrec);
+	if(space)
+		return 0;
+	return ::better(&orec[0], &nrec[0], &orec[m], &nrec[n]) > 0;
+}
+
+/* a parse completed at p.  it is longer than any
+   previous one, or, by closure(), better than one of the
+   same length.  but leftmost comes first */
+
+void Pike::done(Hist *h, int start, int p)
+{
+	if(flags&REG_ANCH && p!=len)
+		return;
+	if(bestso>=0 && start>bestso)
+		return;
+	if(h)
+		h->ref++;
+	release(besth);
+	besth = h;
+	bestso = start;
+	besteo = p;
+}
+
+static inline int eol(uchar *s, int p, int len, int flags)
+{
+	return p<len? s[p]=='\n' && flags&REG_NEWLINE:
+		!(flags&REG_NOTEOL);
+}
+
+/* follow the instructions from pc that don't consume
+   chars, in order of preference, leaving the CHRs in nlist.
+   if a parse reaches a pc that another has reached in this
+   step, the worse of the two is dropped, and if that was
+   the earlier one, the later one is followed anew */
+
+void Pike::push(Array<Thread> &a, int &n, int pc, int start, Hist *h)
+{
+	if(a.assure(n)) {
+		space = 1;
+		release(h);
+		return;
+	}
+	a[n].pc = pc;
+	a[n].start = start;
+	a[n].h = h;
+	n++;
+}
+
+void Pike::closure(int pc, Hist *h, int start, int p)
+{
+	sp = 0;
+	push(stack, sp, pc, start, h);
+	while(sp > 0 && !space) {
+		pc = stack[--sp].pc;
+		h = stack[sp].h;
+		if(stamp[pc] == step) {
+			if(!better(vh[pc], vstart[pc], h, start)) {
+				release(h);
+				continue;
+			}
+			release(vh[pc]);
+			if(inst[pc].op == CHR) {
+				(*nlist)[slot[pc]].pc = -1;
+				release((*nlist)[slot[pc]].h);
+			}
+		} else {
+			stamp[pc] = step;
+			visited[nvisited++] = pc;
+		}
+		if(h)		// 0 only at the start
+			h->ref++;
+		vh[pc] = h;
+		vstart[pc] = start;
+		Inst *ip = &inst[pc];
+		switch(ip->op) {
+		case CHR:
+			slot[pc] = nn;
+			push(*nlist, nn, pc, start, h);
+			continue;
+		case MATCH:
+			done(h, start, p);
+			break;
+		case BOL:
+			if(((flags&REG_NEWLINE) && p>0 && s[p-1]=='\n') ||
+			   (!(flags&REG_NOTBOL) && p==0))
+				push(stack, sp, ip->x, start, h);
+			else
+				break;
+			continue;
+		case EOL:
+			if(eol(s, p, len, flags))
+				push(stack, sp, ip->x, start, h);
+			else
+				break;
+			continue;
+		case SPLIT:
+			if(h)
+				h->ref++;
+			push(stack, sp, ip->y, start, h);
+			push(stack, sp, ip->x, start, h);
+			continue;
+		case MARK: {
+			int empty = ip->empty!=NOCHECK && h->open->p==p;
+			Hist *n = mark(h, pc, p);
+			release(h);
+			if(n == 0)
+				continue;
+			if(!empty)
+				push(stack, sp, ip->x, start, n);
+			else if(ip->empty == EXIT)
+				push(stack, sp, ip->y, start, n);
+			else
+				release(n);
+			continue;
+		}
+		}
+		release(h);
+	}
+	while(sp > 0)
+		release(stack[--sp].h);
+}
+
+/* parses are begun only where the first char could
+   begin a match */
+
+int Pike::exec()
+{
+	int i, p;
+	Thread *t;
+	step = 1;
+	nn = 0;
+	if(canstart(0))
+		closure(prog->start, 0, 0, 0);
+	for(p=0; !space; p++) {
+		for(i=0; i<nvisited; i++)
+			release(vh[visited[i]]);
+		nvisited = 0;
+		Array<Thread> *l = clist;
+		clist = nlist;
+		nlist = l;
+		nc = nn;
+		nn = 0;
+		if(p >= len)
+			break;
+		step++;
+		if(nc == 0) {
+			if(bestso>=0 || prog->anchored)
+				break;
+			while(++p<=len && !canstart(p))
+				continue;
+			if(p > len)
+				break;
+			closure(prog->start, 0, p, p);
+			p--;
+			continue;
+		}
+		Set *set = &prog->set[0];
+		for(i=0; i<nc; i++) {
+			t = &(*clist)[i];
+			if(t->pc < 0 || (bestso>=0 && t->start>bestso))
+				continue;
+			Inst *ip = &inst[t->pc];
+			if(set[ip->y].in(s[p])) {
+				if(t->h)
+					t->h->ref++;
+				closure(ip->x, t->h, t->start, p+1);
+			}
+		}
+		for(i=0; i<nc; i++)
+			if((*clist)[i].pc >= 0)
+				release((*clist)[i].h);
+		if(bestso<0 && !prog->anchored && canstart(p+1))
+			closure(prog->start, 0, p+1, p+1);
+	}
+	for(i=0; i<nc; i++)
+		if((*clist)[i].pc >= 0)
+			release((*clist)[i].h);
+	return space? REG_ESPACE: bestso<0? REG_NOMATCH: 0;
+}
+
+/* rebuild the match array from the history of the best
+   parse, as the recursive matcher would have set it
+   along the way */
+
+void Pike::replay(size_t nmatch, regmatch_t *match)
+{
+	size_t i;
+	int k = besth? besth->depth: 0;
+	Array<Hist*> path;
+	if(path.assure(k)) {
+		space = 1;
+		return;
+	}
+	for(Hist *h=besth; h; h=h->parent)
+		path[--k] = h;
+	for(i=1; i<nmatch; i++)
+		match[i].rm_so = match[i].rm_eo = -1;
+	match[0].rm_so = bestso;
+	match[0].rm_eo = besteo;
+	for(k=0; k<(besth? besth->depth: 0); k++)
+		inst[path[k]->pc].setmatch(path[k]->p, nmatch, match);
+}
+
+/* returns 0, REG_NOMATCH or REG_ESPACE, like regexec */
+
+int Prog::pikeexec(uchar *s, size_t len, size_t nmatch,
+		   regmatch_t *match, int eflags, Ctx *ctx)
+{
+	if(ctx->pike==0 && (ctx->pike = new Pike)==0)
+		return REG_ESPACE;
+	Pike &pike = *ctx->pike;
+	pike.reset(this, s, len, flags|eflags);
+	if(pike.space)
+		return REG_ESPACE;
+	int result = pike.exec();
+	if(result == 0 && nmatch > 0) {
+		pike.replay(nmatch, match);
+		if(pike.space)
+			result = REG_ESPACE;
+	}
+	pike.release(pike.besth);
+	return result;
+}
@@ -0,0 +1,229 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "re.h"
+
+/* a backtracking interpreter of a Prog.  like the recursive
+   matcher of re1.cpp, it tries the alternatives of each
+   SPLIT in order of preference and, the pattern being EASY,
+   takes the first parse that completes.  but the choices
+   not yet taken are kept on a stack in the Ctx, not on the
+   C stack, and each step is a switch on an instruction, not
+   a virtual call.  a MARK puts on the stack what it
+   overwrites, to be restored when the parse backs up.
+
+   the registers in reg are rm_so and rm_eo of each
+   subexpression wanted, then, for each Rep, where its
+   current iteration began, which tells whether an
+   iteration was null.
+
+   failures are remembered, as at the memo points of
+   Rep1::parse.  from a CHR, the rest of a parse cannot
+   depend on how it got there: the subpatterns still open
+   began no later, so none of them can now be found null.
+   so a CHR that is reached again at the same place fails
+   again.  only CHRs that can be reached along more than
+   one path have memo bits (see Pcomp::memopoints) */
+
+enum {
+	MEMOBITS = 1<<23,	// most memo bits to use
+	DEPTH = 1<<28		// default most bytes of stack
+};
+
+struct Bvm {
+	Prog *prog;
+	Inst *inst;
+	uchar *s;		// the string
+	int len;
+	int flags;
+	int nreg;		// subexpressions in reg
+	int *reg;
+	int *begi;		// where iterations began, by serial
+	Array<Bframe> &stack;
+	int sp;
+	size_t limit;		// most frames allowed
+	Array<char> &memo;	// bits for CHRs that failed
+	int memosize;		// bytes of them, or 0 if none
+	int memoclear;		// see memobyte()
+	int space;		// out of memory
+	Budget budget;		// steps and time left
+	int spent;		// and none are
+	Bvm(Prog*, uchar*, int, int, int, Ctx*);
+	void push(int pc, int p) {
+		if((size_t)sp >= limit || stack.assure(sp))
+			space = 1;
+		else {
+			stack[sp].pc = pc;
+			stack[sp].p = p;
+			sp++;
+		}
+	}
+	void set(int i, int v) {	// reg[i] = v, undoably
+		if(reg[i] == v)
+			return;
+		if(sp > 0)
+			push(-1-i, reg[i]);
+		reg[i] = v;
+	}
+	int parse(int p0);
+};
+
+Bvm::Bvm(Prog *prog, uchar *s, int len, int flags, int nreg,
+	   Ctx *ctx) : prog(prog), inst(&prog->inst[0]), s(s),
+	len(len), flags(flags), nreg(nreg), stack(ctx->stack),
+	sp(0), memo(ctx->memo), memosize(0), memoclear(0), space(0),
+	budget(ctx), spent(0)
+{
+	limit = (ctx->limit? ctx->limit: (size_t)DEPTH)/sizeof(Bframe);
+	if(ctx->reg.assure(2*nreg + prog->nserial)) {
+		space = 1;
+		return;
+	}
+	reg = &ctx->reg[0];
+	begi = reg + 2*nreg;
+	if(prog->nmemo && len < MEMOBITS/prog->nmemo) {
+		int n = (prog->nmemo*(len+1) + CHAR_BIT-1)/CHAR_BIT;
+		if(memo.assure(n) == 0)
+			memosize = n;
+	}
+}
+
+/* returns 0 with the match in reg, REG_NOMATCH,
+   REG_ESPACE or REG_EBUDGET */
+
+int Bvm::parse(int p0)
+{
+	int i, k, pc, p;
+	for(i=2; i<2*nreg; i++)
+		reg[i] = -1;
+	sp = 0;
+	push(prog->start, p0);
+	while(sp > 0 && !space && !spent) {
+		pc = stack[--sp].pc;
+		p = stack[sp].p;
+		if(pc < 0) {
+			reg[-1-pc] = p;
+			continue;
+		}
+		for(;;) {
+			Inst *ip = &inst[pc];
+			if(budget.spent()) {
+				spent = 1;
+				break;
+			}
+			switch(ip->op) {
+			case CHR:
+				if((k = prog->memo[pc])>=0 && memosize) {
+					k = p*prog->nmemo + k;
+					char *m = memobyte(memo, memosize,
+						memoclear, k);
+					if(*m & 1<<(k%CHAR_BIT))
+						break;
+					*m |= 1<<(k%CHAR_BIT);
+				}
+				if(p>=len || !prog->set[ip->y].in(s[p]))
+					break;
+				p++;
+				pc = ip->x;
+				continue;
+			case SPLIT:
+				push(ip->y, p);
+				pc = ip->x;
+				continue;
+			case BOL:
+				if((flags&REG_NOTBOL || p>0) &&
+				   !(flags&REG_NEWLINE && p>0 && s[p-1]=='\n'))
+					break;
+				pc = ip->x;
+				continue;
+			case EOL:
+				if(p<len? !(flags&REG_NEWLINE && s[p]=='\n'):
+				   flags&REG_NOTEOL)
+					break;
+				pc = ip->x;
+				continue;
+			case MARK:
+				k = ip->x;
+				if(ip->empty!=NOCHECK && begi[ip->serial]==p) {
+					if(ip->empty != EXIT)
+						break;	// null iteration
+					k = ip->y;
+				}
+				if(ip->be == BEGI)
+					set(2*nreg+ip->serial, p);
+				if(ip->n1 > 0 && ip->n1 < nreg) {
+					if(ip->be == BEGS)
+						set(2*ip->n1, p);
+					else if(ip->be == ENDP)
+						set(2*ip->n1+1, p);
+					else for(i=ip->n1; i<=ip->n2 &&
+						   i<nreg; i++) {
+						set(2*i, -1);	// Save::Save
+						set(2*i+1, -1);
+					}
+				}
+				pc = k;
+				continue;
+			case MATCH:
+				if(flags&REG_ANCH && p!=len)
+					break;
+				reg[0] = p0;
+				reg[1] = p;
+				return 0;
+			}
+			break;
+		}
+	}
+	return space? REG_ESPACE: spent? REG_EBUDGET: REG_NOMATCH;
+}
+
+/* regnexec for a pattern with a Prog, from s, the first
+   place a match might begin, when the first parse that
+   completes will do: the pattern is EASY, or only whether
+   there is a match is wanted */
+
+int backexec(const regex_t *preg, Ctx *ctx, uchar *string, size_t len,
+	uchar *s, size_t nmatch, regmatch_t *match, int eflags)
+{
+	Prog *prog = preg->prog;
+	Must *must = preg->must;
+	Start *start = preg->start;
+	Trie *trie = 0;
+	size_t i;
+	int r, nreg = 0;
+	if(!(preg->flags&REG_NOSUB))
+		nreg = nmatch<=preg->re_nsub? nmatch: preg->re_nsub+1;
+	Bvm vm(prog, string, len, preg->flags|eflags, nreg, ctx);
+	if(vm.space)
+		return REG_ESPACE;
+	if(!(preg->flags&ONCE) && preg->rex->type==TRIE)
+		trie = (Trie*)preg->rex;
+	if(prog->anchored) {
+		s = string;
+		must = 0;
+		start = 0;
+	} else if(must && must->off<0) {
+		s = string;
+		must = 0;	// else skip to its candidates
+	}
+	for(;;) {
+		s = candidate(trie, must, start, s, string, string+len,
+			preg->map);
+		if(s == 0)
+			return REG_NOMATCH;
+		r = vm.parse(s - string);
+		if(r != REG_NOMATCH)
+			break;
+		if(prog->anchored || ++s > string+len)
+			return REG_NOMATCH;
+	}
+	if(r != 0 || preg->flags&REG_NOSUB)
+		return r;
+	for(i=0; i<nmatch; i++)
+		if((int)i < nreg) {
+			match[i].rm_so = vm.reg[2*i];
+			match[i].rm_eo = vm.reg[2*i+1];
+		} else
+			match[i].rm_so = match[i].rm_eo = -1;
+	return 0;
+}
@@ -0,0 +1,333 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "re.h"
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT
+#endif
+
+/* compilation of a whole DFA, made by Dfa::table in
+   re3.cpp, into x86-64 code for dfaexec under REG_JIT.
+   the code is called as
+
+	int f(uchar *s, uchar *last, int bol)
+
+   with s in rdi, last in rsi and bol in edx.  most states
+   share one loop that, like Dfa::exec, moves by a table
+   of byte classes and a table of moves, one row per state,
+   in rcx and r9; edx holds the row of the state.  a move
+   to a state that needs more than that is negative, and
+   leaves the loop for the state's own block by a jump
+   table in r10.  such a state has stop bits, which its
+   block tests, or is left by three bytes or fewer, which
+   its block skips to 16 at a time with SSE2, as memchr
+   does.  the blocks keep last-16 in r8 for the skips.
+   where code can't be made in executable memory, jit
+   returns 0 */
+
+struct Jit {
+	uchar *code;
+	size_t size;
+};
+
+#ifdef JIT
+
+enum {				// condition codes
+	JAE = 0x3, JE = 0x4, JNE = 0x5, JA = 0x7, JNS = 0x9
+};
+
+enum {
+	MAXCODE = 1<<22,	// most bytes of code
+	MAXSKIP = 3		// most bytes a skip looks for
+};
+
+struct Fix {			// a 32-bit field yet to be filled
+	int at;			// where it is
+	int label;		// what it points to
+	int base;		// relative to which label, or -1
+};				// for the end of the field
+
+struct Asm {
+	Array<uchar> b;		// the code
+	int n;
+	Array<int> label;	// offset of each label, or -1
+	int nlabel;
+	Array<Fix> fix;
+	int nfix;
+	int space;		// out of memory
+	Asm() : n(0), nlabel(0), nfix(0), space(0) { }
+	void byte(int c) {
+		if(b.assure(n))
+			space = 1;
+		else
+			b[n++] = c;
+	}
+	void op(const char *s, int k) {
+		while(--k >= 0)
+			byte(*s++);
+	}
+	void word(int w) {
+		for(int i=0; i<4; i++)
+			byte(w >> 8*i);
+	}
+	int newlabel() {
+		if(label.assure(nlabel)) {
+			space = 1;
+			return 0;
+		}
+		label[nlabel] = -1;
+		return nlabel++;
+	}
+	void place(int l) { label[l] = n; }
+	void ref(int l, int base) {
+		if(fix.assure(nfix))
+			space = 1;
+		else {
+			fix[nfix].at = n;
+			fix[nfix].label = l;
+			fix[nfix].base = base;
+			nfix++;
+		}
+		word(0);
+	}
+	void jmp(int l) { byte(0xE9); ref(l, -1); }
+	void jcc(int cc, int l) { byte(0x0F); byte(0x80|cc); ref(l, -1); }
+	void align(int k) {
+		while(n % k)
+			byte(0);
+	}
+	void eol(int flags, int yes);
+};
+
+/* go to yes if $ matches before the byte at s, which is
+   not the end */
+
+void Asm::eol(int flags, int yes)
+{
+	if(flags&REG_NEWLINE) {
+		op("\x80\x3F\x0A", 3);		// cmp byte [rdi], '\n'
+		jcc(JE, yes);
+	}
+}
+
+Jit *jit(Dtab *t)
+{
+	Asm a;
+	Array<uchar> own;	// whether each state has its own block
+	Array<int> skip;	// label of each constant for a skip
+	Array<uchar> skipc;	// and the byte it has 16 of
+	int nskip = 0;
+	int i, j, c, k, nesc, ns = t->nstate, nc = t->nclass;
+	int esc[MAXSKIP];
+	for(i=0; i<ns; i++)		// the label of a state is its number
+		a.newlabel();
+	int loop = a.newlabel(), read = a.newlabel(), out = a.newlabel();
+	int done = a.newlabel(), ret0 = a.newlabel(), ret1 = a.newlabel();
+	int reteol = a.newlabel(), cls = a.newlabel(), next = a.newlabel();
+	int states = a.newlabel(), ends = a.newlabel();
+	if(own.assure(ns))
+		return 0;
+	for(i=0; i<ns; i++) {
+		for(nesc=c=0; c<=UCHAR_MAX && nesc<=MAXSKIP; c++)
+			nesc += t->next[i*nc + t->cls[c]] != i;
+		own[i] = t->stop[i] || nesc<=MAXSKIP;
+	}
+
+	a.op("\x4C\x8D\x46\xF0", 4);		// lea r8, [rsi-16]
+	a.op("\x48\x8D\x0D", 3);		// lea rcx, [rip+next]
+	a.ref(next, -1);
+	a.op("\x4C\x8D\x0D", 3);		// lea r9, [rip+cls]
+	a.ref(cls, -1);
+	a.op("\x4C\x8D\x15", 3);		// lea r10, [rip+states]
+	a.ref(states, -1);
+	a.op("\x85\xD2", 2);			// test edx, edx
+	a.jcc(JNE, t->start[1]);
+	a.jmp(t->start[0]);
+
+	a.place(loop);				// the shared loop
+	a.op("\x48\x39\xF7", 3);		// cmp rdi, rsi
+	a.jcc(JAE, done);
+	a.place(read);
+	a.op("\x0F\xB6\x07", 3);		// movzx eax, byte [rdi]
+	a.op("\x48\x83\xC7\x01", 4);		// add rdi, 1
+	a.op("\x41\x0F\xB6\x04\x01", 5);	// movzx eax, byte [r9+rax]
+	a.op("\x01\xD0", 2);			// add eax, edx
+	a.op("\x8B\x14\x81", 3);		// mov edx, [rcx+rax*4]
+	a.op("\x85\xD2", 2);			// test edx, edx
+	a.jcc(JNS, loop);
+	a.place(out);
+	a.op("\xF7\xD2", 2);			// not edx
+	a.op("\x49\x63\x04\x92", 4);		// movsxd rax, [r10+rdx*4]
+	a.op("\x4C\x01\xD0", 3);		// add rax, r10
+	a.op("\xFF\xE0", 2);			// jmp rax
+	a.place(done);				// the end, in row edx
+	a.op("\x89\xD0", 2);			// mov eax, edx
+	a.op("\x31\xD2", 2);			// xor edx, edx
+	a.op("\x41\xBB", 2);			// mov r11d, nc
+	a.word(nc);
+	a.op("\x41\xF7\xF3", 3);		// div r11d
+	a.op("\x4C\x8D\x15", 3);		// lea r10, [rip+ends]
+	a.ref(ends, -1);
+	a.op("\x49\x63\x04\x82", 4);		// movsxd rax, [r10+rax*4]
+	a.op("\x4C\x01\xD0", 3);		// add rax, r10
+	a.op("\xFF\xE0", 2);			// jmp rax
+	a.place(reteol);			// $ at the end
+	if(!(t->flags&REG_NOTEOL))
+		a.jmp(ret1);
+	a.place(ret0);
+	a.op("\x31\xC0\xC3", 3);		// xor eax, eax; ret
+	a.place(ret1);
+	a.op("\xB8\x01\x00\x00\x00\xC3", 6);	// mov eax, 1; ret
+
+	for(i=0; i<ns && !a.space; i++) {
+		int stop = t->stop[i];
+		int end = t->acc[i]&ACC0? ret1: t->acc[i]&ACC1? reteol: ret0;
+		a.place(i);
+		if(stop & DEAD) {
+			a.jmp(ret0);
+			continue;
+		}
+		if(stop & ACC0) {
+			a.jmp(ret1);
+			continue;
+		}
+		if(stop & ACC1) {
+			a.op("\x48\x39\xF7", 3);	// cmp rdi, rsi
+			a.jcc(JAE, end);
+			a.eol(t->flags, ret1);
+			a.byte(0xBA);			// mov edx, row
+			a.word(i*nc);
+			a.jmp(read);
+			continue;
+		}
+		if(!own[i]) {
+			a.byte(0xBA);			// mov edx, row
+			a.word(i*nc);
+			a.jmp(loop);
+			continue;
+		}
+		for(nesc=c=0; c<=UCHAR_MAX; c++)
+			if(t->next[i*nc + t->cls[c]] != i)
+				esc[nesc++] = c;
+		if(nesc == 0) {			// stays to the end
+			a.op("\x48\x89\xF7", 3);	// mov rdi, rsi
+			a.jmp(end);
+			continue;
+		}
+		int skipping = a.newlabel(), hit = a.newlabel();
+		int found = a.newlabel();
+		a.place(skipping);
+		a.op("\x4C\x39\xC7", 3);		// cmp rdi, r8
+		a.jcc(JA, found);
+		a.op("\xF3\x0F\x6F\x07", 4);		// movdqu xmm0, [rdi]
+		for(j=0; j<nesc; j++) {
+			if(skip.assure(nskip) || skipc.assure(nskip))
+				return 0;
+			skip[nskip] = a.newlabel();
+			skipc[nskip] = esc[j];
+			if(j == 0) {
+				a.op("\x66\x0F\x6F\xC8", 4);	// movdqa xmm1, xmm0
+				a.op("\x66\x0F\x74\x0D", 4);	// pcmpeqb xmm1, [rip+c]
+				a.ref(skip[nskip], -1);
+			} else {
+				a.op("\x66\x0F\x6F\xD0", 4);	// movdqa xmm2, xmm0
+				a.op("\x66\x0F\x74\x15", 4);	// pcmpeqb xmm2, [rip+c]
+				a.ref(skip[nskip], -1);
+				a.op("\x66\x0F\xEB\xCA", 4);	// por xmm1, xmm2
+			}
+			nskip++;
+		}
+		a.op("\x66\x0F\xD7\xC1", 4);		// pmovmskb eax, xmm1
+		a.op("\x85\xC0", 2);			// test eax, eax
+		a.jcc(JNE, hit);
+		a.op("\x48\x83\xC7\x10", 4);		// add rdi, 16
+		a.jmp(skipping);
+		a.place(hit);
+		a.op("\x0F\xBC\xC0", 3);		// bsf eax, eax
+		a.op("\x48\x01\xC7", 3);		// add rdi, rax
+		a.place(found);				// near the end, or
+		a.byte(0xBA);				// at a byte that leaves
+		a.word(i*nc);				// mov edx, row
+		a.jmp(loop);
+		if(a.n > MAXCODE)
+			return 0;
+	}
+
+	a.align(16);				// constants for pcmpeqb
+	for(j=0; j<nskip; j++) {
+		a.place(skip[j]);
+		for(k=0; k<16; k++)
+			a.byte(skipc[j]);
+	}
+	a.place(cls);
+	for(c=0; c<=UCHAR_MAX; c++)
+		a.byte(t->cls[c]);
+	a.place(next);				// rows of moves
+	for(i=0; i<ns*nc; i++) {
+		j = t->next[i];
+		a.word(own[j]? ~j: j*nc);
+	}
+	a.place(states);			// jump tables
+	for(i=0; i<ns; i++)
+		a.ref(i, states);
+	a.place(ends);
+	for(i=0; i<ns; i++)
+		a.ref(t->acc[i]&ACC0? ret1: t->acc[i]&ACC1? reteol: ret0,
+		      ends);
+	if(a.space || a.n > MAXCODE)
+		return 0;
+	for(j=0; j<a.nfix; j++) {
+		Fix *f = &a.fix[j];
+		int base = f->base<0? f->at+4: a.label[f->base];
+		int v = a.label[f->label] - base;
+		for(k=0; k<4; k++)
+			a.b[f->at+k] = v >> 8*k;
+	}
+
+	Jit *jit = new Jit;
+	jit->size = a.n;
+	jit->code = (uchar*)mmap(0, jit->size, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(jit->code == MAP_FAILED) {
+		delete jit;
+		return 0;
+	}
+	memmove(jit->code, &a.b[0], a.n);
+	if(mprotect(jit->code, jit->size, PROT_READ|PROT_EXEC) != 0) {
+		jitfree(jit);
+		return 0;
+	}
+	return jit;
+}
+
+int jitexec(Jit *jit, uchar *s, uchar *last, int bol)
+{
+	return ((int(*)(uchar*, uchar*, int))jit->code)(s, last, bol);
+}
+
+void jitfree(Jit *jit)
+{
+	if(jit) {
+		munmap(jit->code, jit->size);
+		delete jit;
+	}
+}
+
+#else
+
+Jit *jit(Dtab*)
+{
+	return 0;
+}
+
+int jitexec(Jit*, uchar*, uchar*, int)
+{
+	return -1;
+}
+
+void jitfree(Jit*)
+{
+}
+
+#endif
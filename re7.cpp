@@ -0,0 +1,217 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "re.h"
+
+/* sets of patterns matched at once, for grep -e -e ... and
+   the like, which want to know which of many patterns
+   match.  setadd (re3.cpp) puts as many patterns as fit
+   into the Prog of a group, whose automaton tells them
+   apart by their MATCHes and finds them all in one pass.
+   patterns with no Prog (backreferences, ! and &) stand
+   alone and are run by regctxexec one by one */
+
+struct Rset {
+	Array<regex_t> re;
+	int nre;
+	Array<int> group;	// group of each pattern, or -1
+	Array<Prog*> prog;	// Prog of each group
+	int ngroup;
+	int cflags;
+	Rset() : nre(0), ngroup(0) { }
+	~Rset();
+};
+
+Rset::~Rset()
+{
+	int i;
+	for(i=0; i<ngroup; i++)
+		delete prog[i];
+	for(i=0; i<nre; i++)
+		regfree(&re[i]);
+}
+
+static Prog *newgroup(Rset *set)
+{
+	if(set->prog.assure(set->ngroup))
+		return 0;
+	Prog *prog = new Prog(set->cflags);
+	prog->anchored = (set->cflags&REG_ANCH) != 0;
+	set->prog[set->ngroup++] = prog;
+	return prog;
+}
+
+/* group the patterns of a set whose re[] is filled */
+
+static int groups(Rset *set)
+{
+	int i;
+	Prog *prog = 0;
+	for(i=0; i<set->nre; i++) {
+		regex_t *preg = &set->re[i];
+		set->group[i] = -1;
+		if(prog && setadd(prog, preg, i) == 0) {
+			set->group[i] = set->ngroup - 1;
+			continue;
+		}
+		if(prog==0 || prog->nid>0) {	// try a new group
+			if((prog = newgroup(set)) == 0)
+				return REG_ESPACE;
+			if(setadd(prog, preg, i) == 0)
+				set->group[i] = set->ngroup - 1;
+		}
+	}
+	if(prog && prog->nid==0) {
+		delete prog;
+		set->ngroup--;
+	}
+	return 0;
+}
+
+int regsetcomp(regset_t *rs, const char *const *pat, size_t n, int cflags)
+{
+	int i, r;
+	Rset *set = new Rset;
+	rs->rs_n = 0;
+	rs->set = 0;
+	set->cflags = cflags & (CFLAGS|GFLAGS);
+	if(n>0 && (set->re.assure(n-1) || set->group.assure(n-1))) {
+		delete set;
+		return REG_ESPACE;
+	}
+	for(i=0; (size_t)i<n; i++) {
+		if((r = regcomp(&set->re[i], pat[i], cflags)) != 0) {
+			delete set;
+			return r;
+		}
+		set->nre++;
+	}
+	if((r = groups(set)) != 0) {
+		delete set;
+		return r;
+	}
+	rs->rs_n = n;
+	rs->set = set;
+	return 0;
+}
+
+/* a set of patterns already compiled with flags cflags,
+   as grep has them after regcomb.  the regex_t's belong
+   to the set from then on, even if it can't be made */
+
+int regsetmake(regset_t *rs, regex_t *re, size_t n, int cflags)
+{
+	int r;
+	Rset *set = new Rset;
+	rs->rs_n = 0;
+	rs->set = 0;
+	set->cflags = cflags & (CFLAGS|GFLAGS);
+	if(n>0 && (set->re.assure(n-1) || set->group.assure(n-1))) {
+		while(n > 0)
+			regfree(&re[--n]);
+		delete set;
+		return REG_ESPACE;
+	}
+	memmove(&set->re[0], re, n*sizeof(regex_t));
+	set->nre = n;
+	if((r = groups(set)) != 0) {
+		delete set;
+		return r;
+	}
+	rs->rs_n = n;
+	rs->set = set;
+	return 0;
+}
+
+/* sets which[i] to 1 if pattern i matches string, else 0.
+   returns 0 if any does, else REG_NOMATCH or an error.
+   if match is not 0, match[i] gets the leftmost-longest
+   match of each pattern i that matches, as regnexec would
+   give it with nmatch 1, or (-1,-1).  if which is 0, as
+   for grep, only whether any matches is found, and the
+   search stops at the first.  the groups, a pass each,
+   go before the patterns that stand alone, which may
+   backtrack */
+
+static int anyexec(Rset *set, regctx_t *ctx, const char *string, size_t len,
+	int eflags)
+{
+	uchar *s = (uchar*)string;
+	int i, g, r;
+	for(g=0; g<=set->ngroup; g++) {	// the groups, then those alone
+		if(g < set->ngroup) {
+			r = set->prog[g]->setexec(s, s+len,
+				set->cflags | (eflags&EFLAGS), 0);
+			if(r >= 0) {
+				if(r)
+					return 0;
+				continue;
+			}
+		}
+		for(i=0; i<set->nre; i++) {	// busy, or alone
+			if(set->group[i] != (g<set->ngroup? g: -1))
+				continue;
+			r = regctxexec(&set->re[i], ctx, string, len,
+				0, 0, eflags);
+			if(r != REG_NOMATCH)
+				return r;
+		}
+	}
+	return REG_NOMATCH;
+}
+
+
+int regsetexec(const regset_t *rs, regctx_t *ctx, const char *string,
+	size_t len, unsigned char *which, regmatch_t *match, int eflags)
+{
+	Rset *set = rs->set;
+	uchar *s = (uchar*)string;
+	int i, g, r, any = 0;
+	if(set == 0)
+		return REG_BADPAT;
+	if(which == 0)
+		return anyexec(set, ctx, string, len, eflags);
+	memset(which, 0, set->nre);
+	for(g=0; g<set->ngroup; g++)
+		if(set->prog[g]->setexec(s, s+len,
+		   set->cflags | (eflags&EFLAGS), which) < 0)
+			for(i=0; i<set->nre; i++) {
+				if(set->group[i] != g)	// busy; one by one
+					continue;
+				r = regctxexec(&set->re[i], ctx, string,
+					len, 0, 0, eflags);
+				if(r == 0)
+					which[i] = 1;
+				else if(r != REG_NOMATCH)
+					return r;
+			}
+	for(i=0; i<set->nre; i++) {
+		if(set->group[i] >= 0)
+			continue;
+		r = regctxexec(&set->re[i], ctx, string, len, 0, 0, eflags);
+		if(r == 0)
+			which[i] = 1;
+		else if(r != REG_NOMATCH)
+			return r;
+	}
+	for(i=0; i<set->nre; i++) {
+		any |= which[i];
+		if(match == 0)
+			continue;
+		match[i].rm_so = match[i].rm_eo = -1;
+		if(which[i] && !(set->cflags&REG_NOSUB)) {
+			r = regctxexec(&set->re[i], ctx, string, len,
+				1, &match[i], eflags);
+			if(r != 0)
+				return r;
+		}
+	}
+	return any? 0: REG_NOMATCH;
+}
+
+void regsetfree(regset_t *rs)
+{
+	delete rs->set;
+	rs->set = 0;
+	rs->rs_n = 0;
+}
@@ -17,6 +17,11 @@ typedef struct {
 	size_t re_nsub;		/* number of subexpressions */
 			/* local fields, not specified by posix */
 	struct Rex *rex;	/* compiled expression */
+	struct Prog *prog;	/* same, as an automaton, or 0 */
+	int nmemo;		/* memo points in rex */
+	struct Must *must;	/* literal in every match, or 0 */
+	struct Start *start;	/* where a match can begin, or 0 */
+	struct Arena *arena;	/* storage for rex */
 	int flags;		/* flags from regcomp() */
 	unsigned char *map;	/* for REG_ICASE folding */
 	int unused1;
@@ -24,14 +29,109 @@ typedef struct {
 
 int regcomp(regex_t*, const char*, int);
 int regexec(const regex_t*, const char*, size_t, regmatch_t*, int);
-size_t regerror(int, const regex_t*, const char*, size_t);
+size_t regerror(int, const regex_t*, char*, size_t);
 void regfree(regex_t*);
 
 	/* functions needed by grep (nonstandard) */
 
 int regcomb(regex_t*, regex_t*);
+
+	/* regnexec matches the len bytes from string, which
+	   need not be followed by a NUL; no byte past them is
+	   read.  $ matches at the end of them, not at a NUL
+	   among them */
+
 int regnexec(const regex_t*, const char*, size_t, size_t, regmatch_t*, int);
 
+	/* a compiled pattern as bytes, for a file that a later
+	   process can map in and match from where it lies.
+	   regsave returns how many bytes the pattern takes,
+	   putting them in buf if n is enough, or 0 if the
+	   pattern is not of a kind that is saved.  regmap makes
+	   a regex_t from bytes regsave made on the same kind of
+	   machine; they must be 8-byte aligned and stay put
+	   until regfree */
+
+size_t regsave(const regex_t*, void*, size_t);
+int regmap(regex_t*, const void*, size_t);
+
+	/* scratch space kept from one regctxexec to the next;
+	   one thread at a time.  a null regctx_t is allowed */
+
+typedef struct Ctx regctx_t;
+regctx_t *regctxalloc(void);
+void regctxfree(regctx_t*);
+int regctxexec(const regex_t*, regctx_t*, const char*, size_t, size_t,
+	regmatch_t*, int);
+
+	/* most bytes of stack a backtracking match may use, or
+	   0 for the default; beyond it regctxexec gives up with
+	   REG_ESPACE.  by default the recursive matcher goes as
+	   deep as the stack of the calling thread allows, less a
+	   margin, whatever its size */
+
+void regctxlimit(regctx_t*, size_t);
+
+	/* most steps a backtracking match may take, and most
+	   milliseconds, or 0 for no limit; beyond either
+	   regctxexec gives up with REG_EBUDGET.  the automata
+	   take time in proportion to the subject and are not
+	   limited */
+
+void regctxbudget(regctx_t*, unsigned long, unsigned long);
+
+	/* the matches of a pattern in a subject one after
+	   another, as sed s///g takes them: each is sought
+	   where the last ended, or a byte on if it was empty.
+	   regiterexec gives offsets from the start of the
+	   subject, and REG_NOMATCH when there are no more.  the
+	   pattern must not be compiled with REG_NOSUB */
+
+typedef struct {
+	const char *ri_s;	/* the subject */
+	size_t ri_len;
+	size_t ri_at;		/* where the next is sought */
+	int ri_flags;		/* regexec flags */
+} regiter_t;
+void regiterinit(regiter_t*, const char*, size_t, int);
+int regiterexec(const regex_t*, regctx_t*, regiter_t*, size_t,
+	regmatch_t*);
+
+	/* sets of patterns matched together.  regsetexec tells
+	   which of them match, in which[], one byte a pattern,
+	   and if match is not 0, where: the leftmost-longest
+	   match of each, or (-1,-1).  if which is 0, only
+	   whether any matches.  regsetmake makes a set of
+	   patterns already compiled, and takes them over */
+
+typedef struct {
+	size_t rs_n;		/* number of patterns */
+	struct Rset *set;
+} regset_t;
+int regsetcomp(regset_t*, const char *const*, size_t, int);
+int regsetexec(const regset_t*, regctx_t*, const char*, size_t,
+	unsigned char*, regmatch_t*, int);
+int regsetmake(regset_t*, regex_t*, size_t, int);
+void regsetfree(regset_t*);
+
+	/* matching a subject that comes a piece at a time.  if
+	   a match ends in the n bytes given, regstreamexec
+	   returns 0, with *used the bytes read up to where the
+	   first to end does and *end its offset in the whole
+	   subject; the next call looks for a match that begins
+	   there.  otherwise it reads all n and returns
+	   REG_NOMATCH.  regstreamend says likewise whether one
+	   ends where the subject does.  a pattern that needs
+	   backreferences, ! or &, or is too big, can't be
+	   streamed, and regstreamopen returns 0.  close the
+	   stream before regfree */
+
+typedef struct Stream regstream_t;
+regstream_t *regstreamopen(const regex_t*, int);
+int regstreamexec(regstream_t*, const char*, size_t, size_t*, regoff_t*);
+int regstreamend(regstream_t*, regoff_t*);
+void regstreamclose(regstream_t*);
+
 			/* regcomp flags */
 #define REG_EXTENDED 	0x0001
 #define REG_ICASE 	0x0002
@@ -42,9 +142,10 @@ int regnexec(const regex_t*, const char*, size_t, size_t, regmatch_t*, int);
 #define REG_NOTEOL 	0x0020
 			/* nonstandard flags */
 #define REG_NULL 	0x0040	/* allow null patterns for grep */
-#define REG_ANCH 	0x0080	/* grep option -x (no Kmp) */
+#define REG_ANCH 	0x0080	/* grep option -x (no Find) */
 #define REG_LITERAL 	0x0100	/* grep option -F (no operators) */
 #define REG_AUGMENTED	0x0200	/* allow & and ! operators */
+#define REG_JIT		0x0400	/* compile the automaton to machine code */
 
 enum {			/* regex error codes */
 	REG_NOMATCH = 1,
@@ -59,7 +160,8 @@ enum {			/* regex error codes */
 	REG_BADBR,
 	REG_ERANGE,
 	REG_ESPACE,
-	REG_BADRPT
+	REG_BADRPT,
+	REG_EBUDGET		/* nonstandard: see regctxbudget */
 };
 
 #ifdef __cplusplus
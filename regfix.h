@@ -0,0 +1,240 @@
+#ifndef REGFIX_H
+#define REGFIX_H
+#include <string.h>
+#include "regex.h"
+
+/* regcomp at compile time, for patterns fixed in the source.
+
+	static constexpr char pat[] = "^Subject: ";
+	static const Regfix<pat, REG_EXTENDED|REG_ICASE> re;
+	...
+	if(re.exec(line, 1, match, 0) == 0)
+
+   exec and nexec return what regexec and regnexec would
+   for the same pattern and flags.  a pattern that, read
+   by the rules of token() and the escape table of re2.cpp,
+   is only literal bytes, perhaps between ^ and $, becomes
+   a search whose bytes are constants in the code.  any
+   other pattern, or REG_ANCH, or REG_ICASE with a byte
+   beyond ASCII (whose folding depends on the locale), is
+   compiled by regcomp when the Regfix is made, and error
+   tells how that went.  pat must have linkage and be at
+   most a few hundred bytes, the depth of recursion that
+   compilers allow in a constant expression */
+
+			/* pattern types, as in re2.cpp */
+enum { RF_BRE, RF_ERE, RF_ARE, RF_LIT };
+
+			/* tokens that are not literal bytes */
+enum { RF_END = -1, RF_DOLL = -2, RF_BAD = -3 };
+
+constexpr int rftype(int cflags)
+{
+	return cflags&REG_LITERAL? RF_LIT:
+	    cflags&REG_AUGMENTED? RF_ARE:
+	    cflags&REG_EXTENDED? RF_ERE: RF_BRE;
+}
+
+/* c stands for itself unescaped; ^ first and $ last
+   are dealt with in rftoken */
+
+constexpr bool rfplain(int c, int t)
+{
+	return !(c=='\\' || c=='.' || c=='*' || c=='[' ||
+	    (t!=RF_BRE && (c=='^' || c=='$' || c=='|' || c=='+' ||
+		c=='?' || c=='(' || c=='{')) ||
+	    (t==RF_ARE && (c=='&' || c=='!')));
+}
+
+/* \c stands for c */
+
+constexpr bool rfescaped(int c, int t)
+{
+	return c=='\\' || c=='^' || c=='.' || c=='$' || c=='*' ||
+	    c=='[' ||
+	    (t!=RF_BRE && (c=='|' || c=='+' || c=='?' || c=='(' ||
+		c==')' || c=='{')) ||
+	    (t==RF_ARE && (c=='&' || c=='!'));
+}
+
+constexpr int rftoken(const char *p, int i, int t)
+{
+	return p[i]==0? RF_END:
+	    t==RF_LIT? (unsigned char)p[i]:
+	    p[i]=='\\'? (p[i+1] && rfescaped(p[i+1], t)?
+		(unsigned char)p[i+1]: int(RF_BAD)):
+	    p[i]=='$' && p[i+1]==0? RF_DOLL:
+	    rfplain(p[i], t)? (unsigned char)p[i]: int(RF_BAD);
+}
+
+/* like eat() in re2.cpp, skip the byte after a \ even
+   under REG_LITERAL */
+
+constexpr int rfnext(const char *p, int i)
+{
+	return i + (p[i]=='\\' && p[i+1]? 2: 1);
+}
+
+constexpr int rfbegin(const char *p, int t)
+{
+	return t!=RF_LIT && p[0]=='^';
+}
+
+/* how many literal bytes from p[i] on, or -1 if some
+   token is not one */
+
+constexpr int rfcount(const char *p, int i, int t, int n)
+{
+	return rftoken(p, i, t)==RF_BAD? -1:
+	    rftoken(p, i, t) < 0? n:
+	    rfcount(p, rfnext(p, i), t, n+1);
+}
+
+/* whether the pattern from p[i] on ends with $ */
+
+constexpr bool rfdoll(const char *p, int i, int t)
+{
+	return rftoken(p, i, t) < 0? rftoken(p, i, t)==RF_DOLL:
+	    rfdoll(p, rfnext(p, i), t);
+}
+
+/* the kth literal byte from p[i] on */
+
+constexpr unsigned char rfnth(const char *p, int i, int t, int k)
+{
+	return k==0? rftoken(p, i, t): rfnth(p, rfnext(p, i), t, k-1);
+}
+
+constexpr bool rfhigh(const char *p)
+{
+	return *p && ((unsigned char)*p>=0x80 || rfhigh(p+1));
+}
+
+/* byte s is c, or under REG_ICASE its other case.  the
+   pattern has only ASCII, which toupper() in re2.cpp
+   folds the same in every locale */
+
+constexpr bool rfletter(int c)
+{
+	return (c|0x20)>='a' && (c|0x20)<='z';
+}
+
+template<bool icase, unsigned char c>
+inline bool rfsame(unsigned char s)
+{
+	return icase && rfletter(c)? (s|0x20)==(c|0x20): s==c;
+}
+
+/* whether the bytes at s are c..., one comparison with a
+   constant apiece */
+
+template<bool icase, unsigned char... c> struct Rfeq;
+template<bool icase> struct Rfeq<icase> {
+	static bool at(const unsigned char*) { return true; }
+};
+template<bool icase, unsigned char c, unsigned char... r>
+struct Rfeq<icase, c, r...> {
+	static bool at(const unsigned char *s) {
+		return rfsame<icase, c>(*s) &&
+			Rfeq<icase, r...>::at(s+1);
+	}
+};
+
+template<int... i> struct Rfseq { };
+template<int n, int... i> struct Rfmkseq : Rfmkseq<n-1, n-1, i...> { };
+template<int... i> struct Rfmkseq<0, i...> { typedef Rfseq<i...> seq; };
+
+/* leftmost place in s where the literal bytes c... are,
+   with the anchors bol and doll; -1 if none.  the tests
+   for ^ and $ are those of BOL and EOL in re5.cpp */
+
+template<int cflags, bool bol, bool doll, unsigned char c0,
+	unsigned char... c>
+struct Rfsearch {
+	enum { n = 1 + sizeof...(c), icase = (cflags&REG_ICASE)!=0 };
+	static long find(const unsigned char *s, size_t len,
+			 int eflags) {
+		const unsigned char *p = s, *last;
+		if(len < n)
+			return -1;
+		last = s + len - n;
+		if(bol && !(cflags&REG_NEWLINE))
+			last = s;
+		for( ; p<=last; p++) {
+			if(icase && rfletter(c0)) {
+				while(p<=last && (*p|0x20)!=(c0|0x20))
+					p++;
+				if(p > last)
+					break;
+			} else if((p = (const unsigned char*)
+			    memchr(p, c0, last-p+1)) == 0)
+				break;
+			if(bol && (eflags&REG_NOTBOL || p>s) &&
+			   !(cflags&REG_NEWLINE && p>s && p[-1]=='\n'))
+				continue;
+			if(!Rfeq<icase, c...>::at(p+1))
+				continue;
+			if(doll && (p+n<s+len?
+			    !(cflags&REG_NEWLINE && p[n]=='\n'):
+			    eflags&REG_NOTEOL))
+				continue;
+			return p - s;
+		}
+		return -1;
+	}
+};
+
+template<const char *pat, int cflags, class S> struct Rfmatch;
+template<const char *pat, int cflags, int... i>
+struct Rfmatch<pat, cflags, Rfseq<i...> > {
+	enum { t = rftype(cflags), b = rfbegin(pat, t) };
+	typedef Rfsearch<cflags, b, rfdoll(pat, b, t),
+		rfnth(pat, b, t, i)...> search;
+};
+
+template<const char *pat, int cflags>
+struct Regfix {
+	enum {
+		t = rftype(cflags),
+		n = rfcount(pat, rfbegin(pat, t), t, 0),
+		lit = n > 0 && !(cflags&REG_ANCH) &&
+			!(cflags&REG_ICASE && rfhigh(pat))
+	};
+	typedef typename Rfmatch<pat, cflags,
+		typename Rfmkseq<lit? n: 1>::seq>::search search;
+	regex_t re;		// for a pattern that is not lit
+	int error;		// what regcomp returned
+	Regfix() : error(0) {
+		if(!lit)
+			error = regcomp(&re, pat, cflags);
+	}
+	~Regfix() {
+		if(!lit && error==0)
+			regfree(&re);
+	}
+	int nexec(const char *string, size_t len, size_t nmatch,
+		  regmatch_t *match, int eflags) const {
+		size_t j;
+		long so;
+		if(!lit)
+			return regnexec(&re, string, len, nmatch, match,
+				eflags);
+		so = search::find((const unsigned char*)string, len,
+			eflags);
+		if(so < 0)
+			return REG_NOMATCH;
+		if(cflags&REG_NOSUB || nmatch==0)
+			return 0;
+		match[0].rm_so = so;
+		match[0].rm_eo = so + n;
+		for(j=1; j<nmatch; j++)
+			match[j].rm_so = match[j].rm_eo = -1;
+		return 0;
+	}
+	int exec(const char *string, size_t nmatch, regmatch_t *match,
+		 int eflags) const {
+		return nexec(string, strlen(string), nmatch, match, eflags);
+	}
+};
+
+#endif
@@ -27,6 +27,7 @@ extern void syntax(const char*);
 extern int readline(Text*);
 extern int ateof(void);
 extern void coda(void);
+extern void reerror(int);
 
 #define exch(a, b, t) ((t)=(a), (a)=(b), (b)=(t))
 	
@@ -52,6 +53,7 @@ extern int qflag;
 extern int sflag;
 extern int bflag;
 extern int options;
+extern regctx_t *rectx;
 extern const char *stdouterr;
 
 extern Text files;
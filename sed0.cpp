@@ -18,14 +18,16 @@ int qflag;		/* command q executed */
 int sflag;		/* substitution has occurred */
 int bflag;		/* strip leading blanks from c,a,i <text> */
 int options;		/* conjunction, negation */
+regctx_t *rectx;	/* matcher's scratch space, kept throughout */
 
 int
 main(int argc, char **argv)
 {
 	static Text script;
 	static Text data;
+	unsigned long msec = 0, steps = 0;
 	for(;;) {
-		switch(getopt(argc, argv, "bnf:e:")) {
+		switch(getopt(argc, argv, "bnf:e:t:T:")) {
 		case 'b':
 			bflag++;
 			continue;
@@ -38,9 +40,15 @@ main(int argc, char **argv)
 		case 'n':
 			nflag++;
 			continue;
+		case 't':
+			msec = strtoul(optarg, 0, 10);
+			continue;
+		case 'T':
+			steps = strtoul(optarg, 0, 10);
+			continue;
 		case '?':
-			quit("usage: sed [-n] script [files]\n"
-			"     sed [-n] [-f scriptfile] "
+			quit("usage: sed [-n] [-t ms] [-T steps] script [files]\n"
+			"     sed [-n] [-t ms] [-T steps] [-f scriptfile] "
 			      "[-e script] [files]");
 		case -1:
 			break;
@@ -56,6 +64,8 @@ main(int argc, char **argv)
 		nflag = 1;
 	copyscript(&data, (uchar*)"\n\n");  /* e.g. s/a/\ */
 	compile(&script, &data);
+	rectx = regctxalloc();
+	regctxbudget(rectx, steps, msec);
 	// printscript(&script); //  debugging
 
 	initinput(argc-optind, argv+optind);
@@ -82,8 +82,13 @@ execute(Text *script, Text *data)
 int
 sel1(int addr, Text *data)
 {
-	if(addr & REGADR)
-		return regexec(readdr(addr),(char*)data->s,0,0,0) == 0;
+	if(addr & REGADR) {
+		int r = regctxexec(readdr(addr), rectx, (char*)data->s,
+			data->w-data->s, 0, 0, 0);
+		if(r != 0 && r != REG_NOMATCH)
+			reerror(r);
+		return r == 0;
+	}
 	if(addr == recno)
 		return 1;
 	if(addr == DOLLAR)
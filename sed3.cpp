@@ -53,51 +53,49 @@ regmatch_t matches[NMATCH];
 #define so matches[0].rm_so
 #define eo matches[0].rm_eo
 
+/* the matches are taken one after another by regiterexec,
+   which reads the pattern space once for them all */
+
 int
 substitute(regex_t *re, Text* data, uchar *rhs, int n)
 {
 	Text t;
-	uchar *where = data->s;
-	if(regexec(re, (char*)data->s, NMATCH, matches, 0))
-		return 0;
+	regiter_t it;
+	uchar *where = data->s;		/* copied up to here */
+	int k, r, subs = 0;
+	regiterinit(&it, (char*)data->s, data->w-data->s, 0);
 	vacate(&gendata);
-	if(n == 0)
-		do {
-			docopy(where, so);
-			if(!dosub(where, rhs))
-				return 0;
-			where += eo;
-			if(eo == so) {
-				if(where < data->w)
-					docopy(where++, 1);
-				else
-					goto done;
-			}
-		} while(regexec(re, (char*)where, NMATCH, matches, REG_NOTBOL) == 0);
-	else {
-		while(--n > 0) {
-			where += eo;
-			if(eo == so) {
-				if(where < data->w)
-					where++;
-				else
-					return 0;
-			}
-			if(regexec(re, (char*)where, NMATCH, matches, REG_NOTBOL))
-				return 0;
-		}
-		docopy(data->s, where-data->s+so);
-		if(!dosub(where, rhs))
+	for(k=1; (r = regiterexec(re, rectx, &it, NMATCH, matches)) == 0;
+	    k++) {
+		if(n!=0 && k<n)
+			continue;
+		docopy(where, data->s+so-where);
+		if(!dosub(data->s, rhs))
 			return 0;
-		where += eo;
-	}			
-	eo = so = data->w - where;
-	docopy(where, so);
-done:
+		where = data->s + eo;
+		subs = 1;
+		if(n != 0)
+			break;
+	}
+	if(r != 0 && r != REG_NOMATCH)
+		reerror(r);
+	if(!subs)
+		return 0;
+	docopy(where, data->w-where);
 	exch(gendata, *data, t);
 	return 1;
 }
 
+/* a match given up for want of space or time */
+
+void
+reerror(int r)
+{
+	char buf[100];
+	regerror(r, 0, buf, sizeof(buf));
+	quit("%s at input line %d", buf, recno);
+}
+
 void
 docopy(uchar *where, int n)
 {
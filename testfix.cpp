@@ -0,0 +1,207 @@
+/*
+ * Regfix tester
+ *
+ * testfix [-v]
+ *
+ *	-v	list each pattern
+ *
+ * each pattern below is made a Regfix and also compiled by
+ * regcomp; exec and nexec must give what regexec and
+ * regnexec do, return and offsets, for every subject and
+ * every combination of REG_NOTBOL and REG_NOTEOL.  the
+ * last field says whether the pattern should take the
+ * literal path of regfix.h rather than regcomp
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "regex.h"
+#include "regfix.h"
+
+#define PATTERNS \
+	P(b1, "abc", 0, 1) \
+	P(b2, "^abc", 0, 1) \
+	P(b3, "abc$", 0, 1) \
+	P(b4, "^abc$", 0, 1) \
+	P(b5, "a\\.b", 0, 1) \
+	P(b6, "a\\*b", 0, 1) \
+	P(b7, "a\\\\b", 0, 1) \
+	P(b8, "a\\[b", 0, 1) \
+	P(b9, "a\\$b", 0, 1) \
+	P(b10, "a\\^b", 0, 1) \
+	P(b11, "a^b", 0, 1) \
+	P(b12, "a$b", 0, 1) \
+	P(b13, "a+b", 0, 1) \
+	P(b14, "a(b)", 0, 1) \
+	P(b15, "\\^abc\\$", 0, 1) \
+	P(b16, "a\\(b\\)", 0, 0) \
+	P(b17, "a.b", 0, 0) \
+	P(b18, "ab*c", 0, 0) \
+	P(b19, "a\\+b", 0, 0) \
+	P(e1, "abc", REG_EXTENDED, 1) \
+	P(e2, "^abc$", REG_EXTENDED, 1) \
+	P(e3, "a\\+b", REG_EXTENDED, 1) \
+	P(e4, "a\\(b", REG_EXTENDED, 1) \
+	P(e5, "a\\|b", REG_EXTENDED, 1) \
+	P(e6, "a\\?b", REG_EXTENDED, 1) \
+	P(e7, "a\\{b", REG_EXTENDED, 1) \
+	P(e8, "a\\)b", REG_EXTENDED, 1) \
+	P(e9, "a\\.b\\$", REG_EXTENDED, 1) \
+	P(e10, "a+b", REG_EXTENDED, 0) \
+	P(e11, "a|b", REG_EXTENDED, 0) \
+	P(e12, "a(b)", REG_EXTENDED, 0) \
+	P(a1, "a\\&b", REG_EXTENDED|REG_AUGMENTED, 1) \
+	P(a2, "a\\!b", REG_EXTENDED|REG_AUGMENTED, 1) \
+	P(a3, "a&b", REG_EXTENDED|REG_AUGMENTED, 0) \
+	P(l1, "a.b", REG_LITERAL, 1) \
+	P(l2, "^a*b$", REG_LITERAL, 1) \
+	P(l3, "a[b", REG_LITERAL, 1) \
+	P(l4, "a+b", REG_LITERAL|REG_EXTENDED, 1) \
+	P(i1, "abc", REG_ICASE, 1) \
+	P(i2, "^abc$", REG_ICASE, 1) \
+	P(i3, "subject: ", REG_ICASE, 1) \
+	P(i4, "aBc", REG_ICASE|REG_EXTENDED, 1) \
+	P(i5, "a\\.B", REG_ICASE|REG_EXTENDED, 1) \
+	P(i6, "a.b", REG_ICASE|REG_LITERAL, 1) \
+	P(i7, "caf\xc3\xa9", REG_ICASE, 0) \
+	P(i8, "a[bc]", REG_ICASE, 0) \
+	P(n1, "^abc", REG_NEWLINE, 1) \
+	P(n2, "abc$", REG_NEWLINE, 1) \
+	P(n3, "^abc$", REG_NEWLINE, 1) \
+	P(n4, "abc", REG_NEWLINE, 1) \
+	P(n5, "^abc$", REG_NEWLINE|REG_ICASE|REG_EXTENDED, 1) \
+	P(n6, "c$", REG_NEWLINE, 1) \
+	P(n7, "^a", REG_NEWLINE, 1) \
+	P(n8, "a.c", REG_NEWLINE, 0) \
+	P(s1, "abc", REG_NOSUB, 1) \
+	P(s2, "^abc$", REG_NOSUB|REG_NEWLINE, 1) \
+	P(x1, "abc", REG_ANCH, 0) \
+	P(x2, "abc", REG_ANCH|REG_LITERAL, 0)
+
+static const char *subjects[] = {
+	"", "a", "ab", "abc", "xabc", "abcx", "xabcx", "abcabc",
+	"ABC", "aBc", "xAbC", "x\nabc", "abc\nx", "x\nabc\ny",
+	"\nabc\n", "ab\nc", "a.b", "a*b", "a\\b", "a[b", "a$b",
+	"a^b", "a+b", "a(b", "a(b)", "a|b", "a?b", "a{b", "a)b",
+	"a&b", "a!b", "^abc$", "a.b$", "A.B", "acb", "aab", "aaab",
+	"Subject: hi", "SUBJECT: hi", "subject:hi", "xsubject: ",
+	"caf\xc3\xa9", "CAF\xc3\x89", "c", "c\n", "\na", "a\n",
+};
+
+static const int eflagses[] = {
+	0, REG_NOTBOL, REG_NOTEOL, REG_NOTBOL|REG_NOTEOL,
+};
+
+enum { NMATCH = 3 };
+
+static int verbose;
+static int tests;
+static int errors;
+
+static void
+report(const char *pat, const char *flags, const char *s, size_t len,
+	const char *what)
+{
+	printf("ERROR\t%s\t%s\t", flags, pat);
+	for( ; len>0; len--, s++)
+		if(*s == '\n')
+			printf("\\n");
+		else
+			putchar(*s);
+	printf("\t%s\n", what);
+	errors++;
+}
+
+/* one call of exec or nexec against regexec or regnexec */
+
+template<const char *pat, int cflags>
+static void
+compare(const Regfix<pat, cflags> &fix, const regex_t *re,
+	const char *flags, const char *s, size_t len, size_t nmatch,
+	int eflags, int whole)
+{
+	regmatch_t want[NMATCH], got[NMATCH];
+	size_t i;
+	int r, q;
+
+	for(i=0; i<NMATCH; i++) {
+		want[i].rm_so = want[i].rm_eo = -2;
+		got[i] = want[i];
+	}
+	if(whole) {
+		r = regexec(re, s, nmatch, want, eflags);
+		q = fix.exec(s, nmatch, got, eflags);
+	} else {
+		r = regnexec(re, s, len, nmatch, want, eflags);
+		q = fix.nexec(s, len, nmatch, got, eflags);
+	}
+	tests++;
+	if(r != q) {
+		report(pat, flags, s, len, q==0? "matched": "did not match");
+		return;
+	}
+	if(r!=0 || cflags&REG_NOSUB)
+		return;
+	for(i=0; i<nmatch; i++)
+		if(want[i].rm_so!=got[i].rm_so || want[i].rm_eo!=got[i].rm_eo) {
+			report(pat, flags, s, len, "wrong offsets");
+			return;
+		}
+}
+
+template<const char *pat, int cflags>
+static void
+check(const char *flags, int lit)
+{
+	static const Regfix<pat, cflags> fix;
+	regex_t re;
+	size_t i, j, n, len;
+	int err;
+
+	if(verbose)
+		printf("%s\t%s\t%s\n", flags, pat,
+			Regfix<pat, cflags>::lit? "literal": "regcomp");
+	if(Regfix<pat, cflags>::lit != lit)
+		report(pat, flags, "", 0, lit? "not taken as literal":
+			"taken as literal");
+	err = regcomp(&re, pat, cflags);
+	tests++;
+	if(fix.error != err) {
+		report(pat, flags, "", 0, "regcomp differs");
+		if(err == 0)
+			regfree(&re);
+		return;
+	}
+	if(err != 0)
+		return;
+	for(i=0; i<sizeof(subjects)/sizeof(*subjects); i++)
+		for(j=0; j<sizeof(eflagses)/sizeof(*eflagses); j++)
+			for(n=0; n<NMATCH; n++) {
+				len = strlen(subjects[i]);
+				compare(fix, &re, flags, subjects[i], len,
+					n, eflagses[j], 1);
+				compare(fix, &re, flags, subjects[i], len,
+					n, eflagses[j], 0);
+				if(len > 0)
+					compare(fix, &re, flags, subjects[i],
+						len-1, n, eflagses[j], 0);
+			}
+	regfree(&re);
+}
+
+#define P(id, s, f, l) static constexpr char id[] = s;
+PATTERNS
+#undef P
+
+int
+main(int argc, char **argv)
+{
+	if(argc>1 && strcmp(argv[1], "-v")==0)
+		verbose = 1;
+	printf("TEST\t<regfix>\n");
+#define P(id, s, f, l) check<id, f>(#f, l);
+	PATTERNS
+#undef P
+	printf("%d tests, %d errors\n", tests, errors);
+	return errors != 0;
+}
@@ -31,7 +31,7 @@ empty() {
 	fi
 }
 
-trap "rm -f in out expect pat; exit" 0 1 2 13 15
+trap "rm -f in out expect pat cache; exit" 0 1 2 13 15
 
 #---------------------------------------------
 TEST=00		# -q, needed by check()
@@ -338,3 +338,106 @@ ab
 
 grep -x -E 'a.|b' in >out
 compare ${TEST}A
+
+#---------------------------------------------
+TEST=09			# -F, dictionary too big for an automaton
+echo $TEST
+
+awk 'BEGIN{ for(i=10000; i<50000; i+=2) printf "w%05d\n", i }' >pat </dev/null
+awk 'BEGIN{ for(i=0; i<60000; i++) printf "xw%05dy\n", i }' >in </dev/null
+
+grep -c -F -f pat in | check 20000 ${TEST}A
+grep -c -F -v -f pat in | check 40000 ${TEST}B
+grep -c -f pat in | check 20000 ${TEST}C
+grep -c -x -F -f pat in | check 0 ${TEST}D
+awk 'BEGIN{ for(i=0; i<60000; i++) printf "w%05d\n", i }' >in </dev/null
+grep -c -x -F -f pat in | check 20000 ${TEST}E
+
+#---------------------------------------------
+TEST=10			# backtracking too deep for the stack
+echo $TEST
+
+awk 'BEGIN{ for(i=0; i<100000; i++) printf "ab"; print "" }' >in </dev/null
+
+# with a 1MB stack the match must give up, not crash
+(ulimit -s 1024; grep -c '\(ab\)*\1' in 2>/dev/null >/dev/null)
+test $? -eq 2 || echo ${TEST}A failed
+grep -c -E '(ab|ba)*(ab)+$' in | check 1 ${TEST}B
+
+#---------------------------------------------
+TEST=11			# -k, patterns kept compiled in a file
+echo $TEST
+
+awk 'BEGIN{ for(i=10000; i<50000; i+=2) printf "w%05d\n", i; print "z[0-9]" }' >pat </dev/null
+awk 'BEGIN{ for(i=0; i<60000; i++) printf "xw%05dy\n", i; print "z5" }' >in </dev/null
+rm -f cache
+
+grep -c -k cache -f pat in | check 20001 ${TEST}A
+test -s cache || echo ${TEST}B failed
+grep -c -k cache -f pat in | check 20001 ${TEST}C
+grep -c -k cache in | check 20001 ${TEST}D
+grep -c -x -k cache -f pat in | check 1 ${TEST}E
+grep -c -v -k cache in | check 60000 ${TEST}F
+echo w1000 >pat
+grep -c -k cache -f pat in | check 10 ${TEST}G
+head -c 100 cache >out; mv out cache
+grep -c -k cache -f pat in | check 10 ${TEST}H
+grep -c -k cache in | check 10 ${TEST}I
+
+#---------------------------------------------
+TEST=12			# patterns of all kinds matched together
+echo $TEST
+
+cat >pat <<!
+x[0-9]*y
+abc
+^q
+\(zz\)\1
+r$
+abd
+!
+cat >in <<!
+x12y
+xabcx
+aqc
+qa
+zzzz
+zz
+ar
+ra
+abdc
+abe
+!
+
+grep -c -f pat in | check 6 ${TEST}A
+grep -c -v -f pat in | check 4 ${TEST}B
+grep -c -x -f pat in | check 2 ${TEST}C
+grep -c -e abe -e '\(a\)\1' -e b.e in | check 1 ${TEST}D
+
+#---------------------------------------------
+TEST=13			# lines matched where they lie in the file
+echo $TEST
+
+awk 'BEGIN{ for(i=0; i<1023; i++) print "abc"; printf "abcc" }' >in </dev/null
+grep -c 'c$' in 2>/dev/null | check 1024 ${TEST}A
+grep -c -E '(b|c)$' in 2>/dev/null | check 1024 ${TEST}B
+printf 'a\0b\na\n' >in
+grep -c 'a$' in | check 1 ${TEST}C
+grep -c 'a.b' in | check 1 ${TEST}D
+
+#---------------------------------------------
+TEST=14			# -t, -T, a budget for backtracking
+echo $TEST
+
+echo aaaaaaaaaaaaaaaaaaaaaaaaaaaaaab >in
+grep -c -T 100000 '\(a*\)*\(a*\)*\1x*\2$' in 2>/dev/null >/dev/null
+test $? -eq 2 || echo ${TEST}A failed
+grep -c -t 100 '\(a*\)*\(a*\)*\1x*\2$' in 2>/dev/null >/dev/null
+test $? -eq 2 || echo ${TEST}B failed
+grep -c -T 100000 -t 100 'a*b' in | check 1 ${TEST}C
+echo b >>in
+grep -c -T 100000 '\(a*\)*\(a*\)*\1x*\2$' in 2>/dev/null >out
+test $? -eq 2 || echo ${TEST}D failed
+check 1 ${TEST}E <out
+grep -c -v -T 100000 '\(a*\)*\(a*\)*\1x*\2$' in 2>/dev/null | check 1 ${TEST}F
+grep -q -T 100000 '\(a*\)*\(a*\)*\1x*\2$' in 2>/dev/null || echo ${TEST}G failed
@@ -1,8 +1,10 @@
 /*
  * regex tester
  *
- * testre [-n] [-tN] [-v] < testre.dat
+ * testre [-c] [-j] [-n] [-tN] [-v] < testre.dat
  *
+ *	-c	match through one regctx_t, kept for all tests
+ *	-j	compile each pattern with REG_JIT
  *	-n	repeat each test with REG_NOSUB
  *	-tN	time limit, N sec per test (default=10, no limit=0)
  *	-v	list each test line
@@ -33,6 +35,9 @@
 #ifndef REG_AUGMENTED
 #define REG_AUGMENTED 0
 #endif
+#ifndef REG_JIT
+#define REG_JIT 0
+#endif
 
 #ifdef DEBUG		/* tied to MDM's regex package */
 #define MSTAT 1
@@ -67,7 +72,8 @@ struct codes {
 	{REG_BADBR,	"BADBR"},
 	{REG_ERANGE,	"ERANGE"},
 	{REG_ESPACE,	"ESPACE"},
-	{REG_BADRPT,	"BADRPT"}
+	{REG_BADRPT,	"BADRPT"},
+	{REG_EBUDGET,	"EBUDGET"}
 };
 
 int errors;
@@ -75,6 +81,9 @@ int lineno;
 const char *which;
 int prog;
 int nflag;
+int jflag;
+int sflag;
+regctx_t *ctx;
 int verbose;
 int timelim = 10;
 const char *nosubmsg = "";
@@ -120,7 +129,7 @@ doregerror(int code, regex_t *preg)
 		msg = "did not terminate";
 		break;
 	default:
-		regerror(code, preg, msg, sizeof buf);
+		regerror(code, preg, buf, sizeof buf);
 		break;
 	}
 	printf("%s\n", msg);
@@ -314,7 +323,7 @@ int alarmcomp(regex_t *preg, const char *re, int cflags)
 	sig = setjmp(jbuf);
 	if(sig == 0) {
 		alarm(timelim);
-		ret = regcomp(preg, re, cflags);
+		ret = regcomp(preg, re, cflags|jflag);
 		alarm(0);
 	} else
 		ret = -sig;
@@ -327,13 +336,40 @@ int alarmexec(const regex_t *preg, const char *s, size_t nmatch, regmatch_t *mat
 	sig = setjmp(jbuf);
 	if(sig == 0) {
 		alarm(timelim);
-		ret = regexec(preg, s, nmatch, match, eflags);
+		if(ctx)
+			ret = regctxexec(preg, ctx, s, strlen(s),
+				nmatch, match, eflags);
+		else
+			ret = regexec(preg, s, nmatch, match, eflags);
 		alarm(0);
 	} else
 		ret = -sig;
 	return ret;
 }
 
+/* feed s to a stream a byte at a time; a match should be
+   found if regexec found one, and end no later */
+
+void streamcheck(const regex_t *preg, const char *re, const char *s,
+	int eret, regoff_t eo, int eflags)
+{
+	regstream_t *st = regstreamopen(preg, eflags);
+	regoff_t end = -1;
+	size_t i, used, n = strlen(s);
+	int ret = REG_NOMATCH;
+	if(st == 0)
+		return;
+	for(i=0; i<n && ret; i++)
+		ret = regstreamexec(st, s+i, 1, &used, &end);
+	if(ret)
+		ret = regstreamend(st, &end);
+	regstreamclose(st);
+	if((ret==0) != (eret==0))
+		report("stream disagrees\n", re, s);
+	else if(ret==0 && eo>=0 && end>eo)
+		report("stream match ends late\n", re, s);
+}
+
 #define nonstd(flag) (flag? flag: NOTEST)
 
 int main(int argc, const char **argv)
@@ -360,10 +396,22 @@ int main(int argc, const char **argv)
 			{
 			case 0:
 				break;
+			case 'c':
+				ctx = regctxalloc();
+				printf(", context");
+				continue;
+			case 'j':
+				jflag = REG_JIT;
+				printf(", JIT");
+				continue;
 			case 'n':
 				nflag = 1;
 				printf(", NOSUB");
 				continue;
+			case 's':
+				sflag = 1;
+				printf(", stream");
+				continue;
 			case 't':
 				if(*++p == 0)
 					p = "0";
@@ -506,6 +554,9 @@ int main(int argc, const char **argv)
 		if(streq(s, "NULL"))
 			s[0] = 0;
 		eret = alarmexec(&preg, s, nmatch, match, eflags);
+		if(sflag && (eret==0 || eret==REG_NOMATCH))
+			streamcheck(&preg, re, s, eret, nmatch>0 &&
+				!(flags&REG_NOSUB)? match[0].rm_eo: -1, eflags);
 
 		if(prog >= 0) {
 			if(eret == prog)